@@ -0,0 +1,98 @@
+#include "AABB.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "hittable/Mesh.hpp"
+#include "hittable/Triangle.hpp"
+
+namespace {
+bool IntervalIntersect(float* a, float* b) {
+  if (a[0] > b[1]) {
+    return a[0] <= b[1];
+  } else {
+    return b[0] <= a[1];
+  }
+}
+}  // namespace
+
+namespace GLOO {
+bool AABB::Overlap(const AABB& other) const {
+  for (int dim = 0; dim < 3; dim++) {
+    float ia[2] = {mn[dim], mx[dim]};
+    float ib[2] = {other.mn[dim], other.mx[dim]};
+    bool intersect = IntervalIntersect(ia, ib);
+    if (!intersect) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool AABB::Contain(const AABB& other) const {
+  for (int dim = 0; dim < 3; dim++) {
+    if (mn[dim] > other.mn[dim] || mx[dim] < other.mx[dim]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+AABB AABB::Empty() {
+  float inf = std::numeric_limits<float>::infinity();
+  return AABB(glm::vec3(inf), glm::vec3(-inf));
+}
+
+void AABB::UnionWith(const AABB& other) {
+  for (int dim = 0; dim < 3; dim++) {
+    mn[dim] = std::min(mn[dim], other.mn[dim]);
+    mx[dim] = std::max(mx[dim], other.mx[dim]);
+  }
+}
+
+void AABB::Extend(const glm::vec3& point) {
+  mn = glm::min(mn, point);
+  mx = glm::max(mx, point);
+}
+
+bool AABB::IsFinite() const {
+  for (int dim = 0; dim < 3; dim++) {
+    if (!std::isfinite(mn[dim]) || !std::isfinite(mx[dim])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+AABB AABB::Transform(const glm::mat4& matrix) const {
+  AABB bbox = Empty();
+  for (int corner = 0; corner < 8; corner++) {
+    glm::vec3 p((corner & 4) ? mx[0] : mn[0], (corner & 2) ? mx[1] : mn[1],
+                (corner & 1) ? mx[2] : mn[2]);
+    glm::vec4 q = matrix * glm::vec4(p, 1.0f);
+    bbox.Extend(glm::vec3(q) / q.w);
+  }
+  return bbox;
+}
+
+AABB AABB::FromTriangle(const Triangle& triangle) {
+  AABB bbox;
+  bbox.mn = bbox.mx = triangle.GetPosition(0);
+  for (int i = 1; i < 3; i++) {
+    for (int dim = 0; dim < 3; dim++) {
+      bbox.mn[dim] = std::min(bbox.mn[dim], triangle.GetPosition(i)[dim]);
+      bbox.mx[dim] = std::max(bbox.mx[dim], triangle.GetPosition(i)[dim]);
+    }
+  }
+  return bbox;
+}
+
+AABB AABB::FromMesh(const Mesh& mesh) {
+  AABB bbox(mesh.GetTriangleBounds(0));
+  for (size_t i = 1; i < mesh.GetNumTriangles(); i++) {
+    bbox.UnionWith(mesh.GetTriangleBounds(i));
+  }
+  return bbox;
+}
+}  // namespace GLOO
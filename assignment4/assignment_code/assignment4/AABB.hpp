@@ -0,0 +1,44 @@
+#ifndef AABB_H_
+#define AABB_H_
+
+#include <glm/glm.hpp>
+
+namespace GLOO {
+// Forward declarations.
+class Mesh;
+class Triangle;
+
+struct AABB {
+  AABB() {
+  }
+  AABB(const glm::vec3& _mn, const glm::vec3& _mx) : mn(_mn), mx(_mx) {
+  }
+  AABB(float mnx, float mny, float mnz, float mxx, float mxy, float mxz)
+      : mn(glm::vec3(mnx, mny, mnz)), mx(glm::vec3(mxx, mxy, mxz)) {
+  }
+  static AABB FromTriangle(const Triangle& triangle);
+  static AABB FromMesh(const Mesh& mesh);
+  // An inverted box that any UnionWith/Extend call will overwrite.
+  static AABB Empty();
+
+  void UnionWith(const AABB& other);
+  void Extend(const glm::vec3& point);
+  bool Overlap(const AABB& other) const;
+  bool Contain(const AABB& other) const;
+  bool IsFinite() const;
+  // Bounds of this box after an affine transform.
+  AABB Transform(const glm::mat4& matrix) const;
+
+  glm::vec3 GetCenter() const {
+    return 0.5f * (mn + mx);
+  }
+  float GetSurfaceArea() const {
+    glm::vec3 d = mx - mn;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+
+  glm::vec3 mn, mx;
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,187 @@
+#include "AccelCache.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#include "BVH.hpp"
+#include "MappedFile.hpp"
+
+namespace {
+// Bump whenever the file layout or any cached structure changes.
+const uint32_t kCacheVersion = 1;
+const char kCacheMagic[8] = {'G', 'L', 'O', 'O', 'B', 'V', 'H', '\0'};
+// Sections start on cache-line boundaries of the mapped file.
+const uint64_t kSectionAlignment = 64;
+
+enum Section {
+  kPositions,
+  kNormals,
+  kIndices,
+  kNodes,
+  kPrimIndices,
+  kBlocks,
+  kNumSections
+};
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t block_width;
+  float bbox_min[3];
+  float bbox_max[3];
+  uint64_t counts[kNumSections];
+  uint64_t offsets[kNumSections];
+};
+
+const size_t kElementSizes[kNumSections] = {
+    sizeof(glm::vec3), sizeof(glm::vec3),        sizeof(unsigned int),
+    sizeof(GLOO::BVHNode), sizeof(uint32_t), sizeof(GLOO::TriangleBlock)};
+
+// 64-bit FNV-1a.
+uint64_t HashBytes(const char* data, size_t size, uint64_t hash) {
+  for (size_t i = 0; i < size; i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+template <typename T>
+GLOO::ArrayView<T> GetSection(const GLOO::MappedFile& file,
+                              const CacheHeader& header,
+                              Section section) {
+  return GLOO::ArrayView<T>(
+      reinterpret_cast<const T*>(file.GetData() + header.offsets[section]),
+      header.counts[section]);
+}
+}  // namespace
+
+namespace GLOO {
+std::string GetAccelCachePath(const std::string& cache_dir,
+                              const std::string& obj_path) {
+  MappedFile file;
+  if (!file.Open(obj_path)) {
+    throw std::runtime_error("Cannot open " + obj_path + "!");
+  }
+  uint64_t params[] = {kCacheVersion, kTriangleBlockWidth, sizeof(BVHNode),
+                       sizeof(TriangleBlock)};
+  uint64_t hash =
+      HashBytes(file.GetData(), file.GetSize(), 14695981039346656037ull);
+  hash = HashBytes(reinterpret_cast<const char*>(params), sizeof(params), hash);
+
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.bvh",
+           static_cast<unsigned long long>(hash));
+  return cache_dir + "/" + name;
+}
+
+std::shared_ptr<Mesh> LoadCachedMesh(const std::string& path) {
+  auto file = std::make_shared<MappedFile>();
+  if (!file->Open(path) || file->GetSize() < sizeof(CacheHeader)) {
+    return nullptr;
+  }
+  CacheHeader header;
+  memcpy(&header, file->GetData(), sizeof(header));
+  if (memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+      header.version != kCacheVersion ||
+      header.block_width != kTriangleBlockWidth) {
+    return nullptr;
+  }
+  for (int i = 0; i < kNumSections; i++) {
+    if (header.offsets[i] % kSectionAlignment != 0 ||
+        header.offsets[i] > file->GetSize() ||
+        header.counts[i] >
+            (file->GetSize() - header.offsets[i]) / kElementSizes[i]) {
+      return nullptr;
+    }
+  }
+  AABB bbox(glm::vec3(header.bbox_min[0], header.bbox_min[1],
+                      header.bbox_min[2]),
+            glm::vec3(header.bbox_max[0], header.bbox_max[1],
+                      header.bbox_max[2]));
+  const MappedFile& contents = *file;
+  auto indices = GetSection<unsigned int>(contents, header, kIndices);
+  auto nodes = GetSection<BVHNode>(contents, header, kNodes);
+  auto prim_indices = GetSection<uint32_t>(contents, header, kPrimIndices);
+  auto blocks = GetSection<TriangleBlock>(contents, header, kBlocks);
+  // Traversal trusts the BVH's indices, so a damaged or foreign file is
+  // rebuilt rather than traced.
+  if (!BVH::IsValidLayout(nodes, prim_indices, blocks, indices.size() / 3)) {
+    return nullptr;
+  }
+  try {
+    return std::make_shared<Mesh>(
+        std::move(file), bbox,
+        GetSection<glm::vec3>(contents, header, kPositions),
+        GetSection<glm::vec3>(contents, header, kNormals), indices, nodes,
+        prim_indices, blocks);
+  } catch (const std::runtime_error&) {
+    // Mesh rejects vertex arrays that do not match the indices.
+    return nullptr;
+  }
+}
+
+bool SaveCachedMesh(const Mesh& mesh, const std::string& path) {
+  const BVH* bvh = mesh.GetBVH();
+  if (bvh == nullptr) {
+    throw std::runtime_error("Only BVH meshes can be cached!");
+  }
+  const void* sections[kNumSections] = {
+      mesh.GetPositions().data(), mesh.GetNormals().data(),
+      mesh.GetIndices().data(),   bvh->GetNodes().data(),
+      bvh->GetPrimIndices().data(), bvh->GetBlocks().data()};
+
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = kCacheVersion;
+  header.block_width = kTriangleBlockWidth;
+  AABB bbox = mesh.GetLocalBounds();
+  for (int axis = 0; axis < 3; axis++) {
+    header.bbox_min[axis] = bbox.mn[axis];
+    header.bbox_max[axis] = bbox.mx[axis];
+  }
+  header.counts[kPositions] = mesh.GetPositions().size();
+  header.counts[kNormals] = mesh.GetNormals().size();
+  header.counts[kIndices] = mesh.GetIndices().size();
+  header.counts[kNodes] = bvh->GetNodes().size();
+  header.counts[kPrimIndices] = bvh->GetPrimIndices().size();
+  header.counts[kBlocks] = bvh->GetBlocks().size();
+  uint64_t offset = sizeof(header);
+  for (int i = 0; i < kNumSections; i++) {
+    offset = (offset + kSectionAlignment - 1) / kSectionAlignment *
+             kSectionAlignment;
+    header.offsets[i] = offset;
+    offset += header.counts[i] * kElementSizes[i];
+  }
+
+  std::ostringstream temp_path;
+  temp_path << path << ".tmp" << std::random_device()();
+  {
+    std::ofstream out(temp_path.str(), std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t written = sizeof(header);
+    const char padding[kSectionAlignment] = {};
+    for (int i = 0; i < kNumSections; i++) {
+      out.write(padding, header.offsets[i] - written);
+      out.write(static_cast<const char*>(sections[i]),
+                header.counts[i] * kElementSizes[i]);
+      written = header.offsets[i] + header.counts[i] * kElementSizes[i];
+    }
+    if (!out) {
+      std::remove(temp_path.str().c_str());
+      return false;
+    }
+  }
+  if (std::rename(temp_path.str().c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.str().c_str());
+    return false;
+  }
+  return true;
+}
+}  // namespace GLOO
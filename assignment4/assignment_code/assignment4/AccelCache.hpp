@@ -0,0 +1,30 @@
+#ifndef ACCEL_CACHE_H_
+#define ACCEL_CACHE_H_
+
+#include <memory>
+#include <string>
+
+#include "hittable/Mesh.hpp"
+
+namespace GLOO {
+// On-disk cache of mesh BVHs. A cache file holds a mesh's vertex and
+// index arrays and the BVH built over them, laid out so that a later run
+// maps the file and traces it in place instead of parsing and building.
+// Files are named by a hash of the OBJ bytes and the build parameters, so
+// an edited OBJ or a tracer with another triangle block width misses.
+// Arrays are stored in native byte order.
+
+// Path of the cache file in cache_dir for the OBJ at obj_path.
+std::string GetAccelCachePath(const std::string& cache_dir,
+                              const std::string& obj_path);
+// Maps the cache file at path. Returns nullptr if it is missing, was
+// written by an incompatible build, or holds arrays that are out of
+// bounds.
+std::shared_ptr<Mesh> LoadCachedMesh(const std::string& path);
+// Writes mesh, which must use a BVH, to path through a temporary file
+// that is then renamed, so concurrent runs never read a partial file.
+// Returns false if the file could not be written.
+bool SaveCachedMesh(const Mesh& mesh, const std::string& path);
+}  // namespace GLOO
+
+#endif
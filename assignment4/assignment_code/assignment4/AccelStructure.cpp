@@ -0,0 +1,16 @@
+#include "AccelStructure.hpp"
+
+#include <stdexcept>
+
+namespace GLOO {
+AccelType ParseAccelType(const std::string& name) {
+  if (name == "octree") {
+    return AccelType::Octree;
+  } else if (name == "bvh") {
+    return AccelType::BVH;
+  } else if (name == "lazy") {
+    return AccelType::LazyBVH;
+  }
+  throw std::runtime_error("Bad acceleration structure: " + name + "!");
+}
+}  // namespace GLOO
@@ -0,0 +1,48 @@
+#ifndef ACCEL_STRUCTURE_H_
+#define ACCEL_STRUCTURE_H_
+
+#include <string>
+
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "RayPacket.hpp"
+
+namespace GLOO {
+// Forward declarations.
+class Mesh;
+
+enum class AccelType { Octree, BVH, LazyBVH };
+
+// Parses "octree", "bvh" or "lazy"; throws on anything else.
+AccelType ParseAccelType(const std::string& name);
+
+// Spatial index over the triangles of a Mesh. Rays are in the mesh's
+// local coordinates, as for HittableBase::Intersect.
+class AccelStructure {
+ public:
+  virtual ~AccelStructure() {
+  }
+  virtual void Build(const Mesh& mesh) = 0;
+  virtual bool Intersect(const Ray& ray,
+                         float t_min,
+                         HitRecord& record) const = 0;
+  virtual bool Occluded(const Ray& ray, float t_min, float t_max) const = 0;
+  // Same contract as HittableBase::IntersectPacket.
+  virtual unsigned IntersectPacket(const RayPacket& packet,
+                                   float t_min,
+                                   HitRecord* records) const {
+    unsigned hit = 0;
+    for (int lane = 0; lane < kPacketSize; lane++) {
+      if ((packet.mask & (1u << lane)) &&
+          Intersect(packet.GetRay(lane), t_min, records[lane])) {
+        hit |= 1u << lane;
+      }
+    }
+    return hit;
+  }
+  // Bytes held by the index itself, excluding the mesh's triangles.
+  virtual size_t GetMemoryUsage() const = 0;
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,72 @@
+#include "AccumulationBuffer.hpp"
+
+#include <algorithm>
+
+namespace GLOO {
+uint64_t AccumulationBuffer::GetTotalSampleCount() const {
+  uint64_t total = 0;
+  for (uint32_t count : counts_) {
+    total += count;
+  }
+  return total;
+}
+
+size_t AccumulationBuffer::UpdateActivePixels(float threshold,
+                                              uint32_t min_samples) {
+  std::vector<uint8_t> converged(counts_.size());
+  for (size_t i = 0; i < counts_.size(); i++) {
+    uint32_t n = counts_[i];
+    if (n < std::max(min_samples, 2u)) {
+      converged[i] = 0;
+      continue;
+    }
+    float mean = GetLuminance(sums_[i]) / n;
+    float variance =
+        std::max(0.0f, (luminance_squares_[i] - n * mean * mean) / (n - 1));
+    // The standard error of the mean is sqrt(variance / n).
+    converged[i] = variance < threshold * threshold * n;
+  }
+
+  size_t num_active = 0;
+  for (size_t y = 0; y < height_; y++) {
+    for (size_t x = 0; x < width_; x++) {
+      bool active = false;
+      for (size_t sy = y > 0 ? y - 1 : 0; sy <= std::min(y + 1, height_ - 1);
+           sy++) {
+        for (size_t sx = x > 0 ? x - 1 : 0;
+             sx <= std::min(x + 1, width_ - 1); sx++) {
+          active |= !converged[sy * width_ + sx];
+        }
+      }
+      active_[y * width_ + x] = active;
+      num_active += active;
+    }
+  }
+  return num_active;
+}
+
+void AccumulationBuffer::Resolve(Image& image, bool filter) const {
+  for (size_t y = 0; y < height_; y++) {
+    for (size_t x = 0; x < width_; x++) {
+      glm::vec3 sum(0.0f);
+      float weight = 0.0f;
+      int radius = filter ? 1 : 0;
+      for (int dy = -radius; dy <= radius; dy++) {
+        for (int dx = -radius; dx <= radius; dx++) {
+          long sx = long(x) + dx;
+          long sy = long(y) + dy;
+          if (sx < 0 || sy < 0 || sx >= long(width_) || sy >= long(height_)) {
+            continue;
+          }
+          // Tent of radius 2 evaluated at the neighbour's centre.
+          float w = (1.0f - 0.5f * std::abs(dx)) * (1.0f - 0.5f * std::abs(dy));
+          size_t i = sy * width_ + sx;
+          sum += w * sums_[i];
+          weight += w * counts_[i];
+        }
+      }
+      image.SetPixel(x, y, weight > 0.0f ? sum / weight : glm::vec3(0.0f));
+    }
+  }
+}
+}  // namespace GLOO
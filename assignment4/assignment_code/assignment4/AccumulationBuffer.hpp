@@ -0,0 +1,91 @@
+#ifndef ACCUMULATION_BUFFER_H_
+#define ACCUMULATION_BUFFER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "gloo/Image.hpp"
+
+namespace GLOO {
+// Per-pixel sums of the samples traced so far, plus what adaptive
+// sampling needs to estimate each pixel's variance. Pixels are
+// independent, so threads may add samples concurrently as long as they
+// own disjoint pixels.
+class AccumulationBuffer {
+ public:
+  // Covers the size.x x size.y pixels starting at origin; pixels are
+  // addressed by their image coordinates.
+  explicit AccumulationBuffer(const glm::ivec2& size,
+                              const glm::ivec2& origin = glm::ivec2(0))
+      : width_(size.x),
+        height_(size.y),
+        origin_x_(origin.x),
+        origin_y_(origin.y),
+        sums_(size.x * size.y, glm::vec3(0.0f)),
+        luminance_squares_(size.x * size.y, 0.0f),
+        counts_(size.x * size.y, 0),
+        active_(size.x * size.y, 1) {
+  }
+
+  void AddSample(size_t x, size_t y, const glm::vec3& color) {
+    size_t i = GetIndex(x, y);
+    sums_[i] += color;
+    float luminance = GetLuminance(color);
+    luminance_squares_[i] += luminance * luminance;
+    counts_[i]++;
+  }
+  // Adds count samples that sum to sum, such as another buffer's samples
+  // of the pixel. Adaptive sampling does not see them.
+  void AddSamples(size_t x, size_t y, const glm::vec3& sum, uint32_t count) {
+    size_t i = GetIndex(x, y);
+    sums_[i] += sum;
+    counts_[i] += count;
+  }
+  const glm::vec3& GetSum(size_t x, size_t y) const {
+    return sums_[GetIndex(x, y)];
+  }
+  uint32_t GetSampleCount(size_t x, size_t y) const {
+    return counts_[GetIndex(x, y)];
+  }
+  uint64_t GetTotalSampleCount() const;
+
+  // Marks the pixels that still need samples for adaptive sampling: those
+  // where some pixel of the 3x3 neighbourhood has fewer than min_samples
+  // samples or a standard error of its mean luminance of threshold or
+  // more. Looking at neighbours keeps thin features that a pixel's first
+  // samples happened to miss. Call between passes; returns the number of
+  // active pixels.
+  size_t UpdateActivePixels(float threshold, uint32_t min_samples);
+  bool IsActive(size_t x, size_t y) const {
+    return active_[GetIndex(x, y)] != 0;
+  }
+
+  // Writes the mean of each pixel's samples to image, with the origin at
+  // image's pixel (0, 0). With filter, each pixel instead averages the
+  // samples of its 3x3 neighbourhood with the tent of radius 2 pixels
+  // centred on it, taken at each neighbour's centre since sample
+  // positions are not stored: a blur of the pixel means.
+  void Resolve(Image& image, bool filter) const;
+
+ private:
+  size_t GetIndex(size_t x, size_t y) const {
+    return (y - origin_y_) * width_ + (x - origin_x_);
+  }
+  static float GetLuminance(const glm::vec3& color) {
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+  }
+
+  size_t width_;
+  size_t height_;
+  size_t origin_x_;
+  size_t origin_y_;
+  std::vector<glm::vec3> sums_;
+  std::vector<float> luminance_squares_;
+  std::vector<uint32_t> counts_;
+  std::vector<uint8_t> active_;
+};
+}  // namespace GLOO
+
+#endif
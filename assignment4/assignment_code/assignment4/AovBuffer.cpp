@@ -0,0 +1,78 @@
+#include "AovBuffer.hpp"
+
+#include <algorithm>
+
+#include "Random.hpp"
+
+namespace GLOO {
+void AovBuffer::ResolveDepth(Image& image,
+                             float depth_min,
+                             float depth_max) const {
+  for (size_t y = 0; y < image.GetHeight(); y++) {
+    for (size_t x = 0; x < image.GetWidth(); x++) {
+      size_t i = y * width_ + x;
+      float value = 0.0f;
+      if (ids_[i] >= 0) {
+        value = glm::clamp((depth_max - depths_[i]) / (depth_max - depth_min),
+                           0.0f, 1.0f);
+      }
+      image.SetPixel(x, y, glm::vec3(value));
+    }
+  }
+}
+
+void AovBuffer::ResolveNormals(Image& image) const {
+  for (size_t y = 0; y < image.GetHeight(); y++) {
+    for (size_t x = 0; x < image.GetWidth(); x++) {
+      size_t i = y * width_ + x;
+      image.SetPixel(x, y,
+                     ids_[i] >= 0 ? 0.5f * normals_[i] + 0.5f
+                                  : glm::vec3(0.0f));
+    }
+  }
+}
+
+void AovBuffer::ResolveIds(Image& image) const {
+  for (size_t y = 0; y < image.GetHeight(); y++) {
+    for (size_t x = 0; x < image.GetWidth(); x++) {
+      int32_t id = ids_[y * width_ + x];
+      glm::vec3 color(0.0f);
+      if (id >= 0) {
+        uint32_t hash = HashUint(static_cast<uint32_t>(id));
+        // Keep every channel away from black so no object reads as a miss.
+        color = glm::vec3(0.25f) +
+                0.75f * glm::vec3(hash & 0xff, (hash >> 8) & 0xff,
+                                  (hash >> 16) & 0xff) /
+                    255.0f;
+      }
+      image.SetPixel(x, y, color);
+    }
+  }
+}
+
+float AovBuffer::ResolveCost(Image& image) const {
+  std::vector<float> sorted(costs_);
+  float max_cost = 0.0f;
+  if (!sorted.empty()) {
+    auto percentile = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+    std::nth_element(sorted.begin(), percentile, sorted.end());
+    max_cost = *percentile;
+  }
+  static const glm::vec3 kRamp[] = {
+      glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+      glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f, 1.0f, 0.0f),
+      glm::vec3(1.0f, 0.0f, 0.0f)};
+  const int kLastStop = 4;
+  for (size_t y = 0; y < image.GetHeight(); y++) {
+    for (size_t x = 0; x < image.GetWidth(); x++) {
+      float cost = costs_[y * width_ + x];
+      float t = max_cost > 0.0f ? std::min(cost / max_cost, 1.0f) : 0.0f;
+      float position = t * kLastStop;
+      int stop = std::min(int(position), kLastStop - 1);
+      float alpha = position - stop;
+      image.SetPixel(x, y, glm::mix(kRamp[stop], kRamp[stop + 1], alpha));
+    }
+  }
+  return max_cost;
+}
+}  // namespace GLOO
@@ -0,0 +1,81 @@
+#ifndef AOV_BUFFER_H_
+#define AOV_BUFFER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "gloo/Image.hpp"
+
+#include "HitRecord.hpp"
+
+namespace GLOO {
+// Files to write the arbitrary output variables to; empty names are
+// skipped.
+struct AovOutputs {
+  std::string depth_file;
+  float depth_min = 0.0f;
+  float depth_max = 1.0f;
+  std::string normals_file;
+  std::string ids_file;
+  // False-color traversal cost; needs a TRACER_STATS build.
+  std::string heatmap_file;
+
+  bool IsEmpty() const {
+    return depth_file.empty() && normals_file.empty() && ids_file.empty() &&
+           heatmap_file.empty();
+  }
+};
+
+// Depth, world normal and object id of the first hit of each pixel's
+// primary ray, recorded during the beauty pass, and the traversal cost of
+// the whole path of the pixel's first sample.
+class AovBuffer {
+ public:
+  explicit AovBuffer(const glm::ivec2& size)
+      : width_(size.x),
+        depths_(size.x * size.y, 0.0f),
+        normals_(size.x * size.y, glm::vec3(0.0f)),
+        ids_(size.x * size.y, -1),
+        costs_(size.x * size.y, 0.0f) {
+  }
+
+  // record is the shaded hit on object object_index; its time is the
+  // distance along the normalized primary ray.
+  void RecordHit(size_t x,
+                 size_t y,
+                 const HitRecord& record,
+                 size_t object_index) {
+    size_t i = y * width_ + x;
+    depths_[i] = record.time;
+    normals_[i] = record.normal;
+    ids_[i] = static_cast<int32_t>(object_index);
+  }
+  void AddCost(size_t x, size_t y, float cost) {
+    costs_[y * width_ + x] += cost;
+  }
+
+  // Depths in [depth_min, depth_max] go from white to black; pixels
+  // without a hit are black.
+  void ResolveDepth(Image& image, float depth_min, float depth_max) const;
+  // Normals are encoded as 0.5 * n + 0.5; pixels without a hit are black.
+  void ResolveNormals(Image& image) const;
+  // Each object gets its own color; pixels without a hit are black.
+  void ResolveIds(Image& image) const;
+  // Costs go from black through blue, green and yellow to red, which
+  // stands for the 99th percentile of the costs or more so that a few
+  // outliers do not darken the rest. Returns that cost.
+  float ResolveCost(Image& image) const;
+
+ private:
+  size_t width_;
+  std::vector<float> depths_;
+  std::vector<glm::vec3> normals_;
+  std::vector<int32_t> ids_;
+  std::vector<float> costs_;
+};
+}  // namespace GLOO
+
+#endif
@@ -5,6 +5,8 @@
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <algorithm>
+#include <thread>
 
 ArgParser::ArgParser(int argc, const char* argv[]) {
   SetDefaultValues();
@@ -19,6 +21,30 @@ ArgParser::ArgParser(int argc, const char* argv[]) {
       i++;
       assert(i < argc);
       output_file = argv[i];
+    } else if (!strcmp(argv[i], "-depth")) {
+      i++;
+      assert(i < argc);
+      depth_min = atof(argv[i]);
+      i++;
+      assert(i < argc);
+      depth_max = atof(argv[i]);
+      i++;
+      assert(i < argc);
+      depth_file = argv[i];
+    } else if (!strcmp(argv[i], "-normals")) {
+      i++;
+      assert(i < argc);
+      normals_file = argv[i];
+    } else if (!strcmp(argv[i], "-ids")) {
+      i++;
+      assert(i < argc);
+      ids_file = argv[i];
+    } else if (!strcmp(argv[i], "-heatmap")) {
+      i++;
+      assert(i < argc);
+      heatmap_file = argv[i];
+    } else if (!strcmp(argv[i], "-stats")) {
+      stats = true;
     } else if (!strcmp(argv[i], "-size")) {
       i++;
       assert(i < argc);
@@ -32,28 +58,163 @@ ArgParser::ArgParser(int argc, const char* argv[]) {
       bounces = atoi(argv[i]);
     } else if (!strcmp(argv[i], "-shadows")) {
       shadows = true;
+    } else if (!strcmp(argv[i], "-min-throughput")) {
+      i++;
+      assert(i < argc);
+      min_throughput = atof(argv[i]);
+    } else if (!strcmp(argv[i], "-roulette")) {
+      i++;
+      assert(i < argc);
+      roulette = atoi(argv[i]);
+    } else if (!strcmp(argv[i], "-light-cutoff")) {
+      i++;
+      assert(i < argc);
+      light_cutoff = atof(argv[i]);
+    } else if (!strcmp(argv[i], "-light-samples")) {
+      i++;
+      assert(i < argc);
+      light_samples = atoi(argv[i]);
+    } else if (!strcmp(argv[i], "-accel")) {
+      i++;
+      assert(i < argc);
+      accel = argv[i];
+    } else if (!strcmp(argv[i], "-accel-cache")) {
+      i++;
+      assert(i < argc);
+      accel_cache = argv[i];
+    } else if (!strcmp(argv[i], "-threads")) {
+      i++;
+      assert(i < argc);
+      threads = atoi(argv[i]);
+    } else if (!strcmp(argv[i], "-no-packets")) {
+      packets = false;
+    } else if (!strcmp(argv[i], "-wavefront")) {
+      wavefront = true;
+    } else if (!strcmp(argv[i], "-stream-output")) {
+      stream_output = true;
+    } else if (!strcmp(argv[i], "-region")) {
+      render_region = true;
+      i++;
+      assert(i < argc);
+      region_x0 = atoi(argv[i]);
+      i++;
+      assert(i < argc);
+      region_y0 = atoi(argv[i]);
+      i++;
+      assert(i < argc);
+      region_x1 = atoi(argv[i]);
+      i++;
+      assert(i < argc);
+      region_y1 = atoi(argv[i]);
+    } else if (!strcmp(argv[i], "-spp")) {
+      i++;
+      assert(i < argc);
+      spp = atoi(argv[i]);
+    } else if (!strcmp(argv[i], "-time-budget")) {
+      i++;
+      assert(i < argc);
+      time_budget = atof(argv[i]);
+    } else if (!strcmp(argv[i], "-snapshot-every")) {
+      i++;
+      assert(i < argc);
+      snapshot_every = atof(argv[i]);
+    } else if (!strcmp(argv[i], "-jitter")) {
+      jitter = true;
+    } else if (!strcmp(argv[i], "-filter")) {
+      filter = true;
+    } else if (!strcmp(argv[i], "-cube-map-lod")) {
+      cube_map_lod = true;
+    } else if (!strcmp(argv[i], "-adaptive")) {
+      i++;
+      assert(i < argc);
+      adaptive = atof(argv[i]);
+    } else if (!strcmp(argv[i], "-adaptive-min")) {
+      i++;
+      assert(i < argc);
+      adaptive_min = atoi(argv[i]);
     } else {
       printf("Unknown command line argument %d: '%s'\n", i, argv[i]);
       exit(1);
     }
   }
 
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
   std::cout << "Args:\n";
   std::cout << "- input: " << input_file << std::endl;
   std::cout << "- output: " << output_file << std::endl;
+  std::cout << "- depth: " << depth_min << " " << depth_max << " "
+            << depth_file << std::endl;
+  std::cout << "- normals: " << normals_file << std::endl;
+  std::cout << "- ids: " << ids_file << std::endl;
+  std::cout << "- heatmap: " << heatmap_file << std::endl;
   std::cout << "- width: " << width << std::endl;
   std::cout << "- height: " << height << std::endl;
   std::cout << "- bounces: " << bounces << std::endl;
   std::cout << "- shadows: " << shadows << std::endl;
+  std::cout << "- min throughput: " << min_throughput << std::endl;
+  std::cout << "- roulette: " << roulette << std::endl;
+  std::cout << "- light cutoff: " << light_cutoff << std::endl;
+  std::cout << "- light samples: " << light_samples << std::endl;
+  std::cout << "- stats: " << stats << std::endl;
+  std::cout << "- accel: " << accel << std::endl;
+  std::cout << "- accel cache: " << accel_cache << std::endl;
+  std::cout << "- threads: " << threads << std::endl;
+  std::cout << "- packets: " << packets << std::endl;
+  std::cout << "- wavefront: " << wavefront << std::endl;
+  std::cout << "- stream output: " << stream_output << std::endl;
+  if (render_region) {
+    std::cout << "- region: " << region_x0 << " " << region_y0 << " "
+              << region_x1 << " " << region_y1 << std::endl;
+  }
+  std::cout << "- spp: " << spp << std::endl;
+  std::cout << "- time budget: " << time_budget << std::endl;
+  std::cout << "- snapshot every: " << snapshot_every << std::endl;
+  std::cout << "- jitter: " << jitter << std::endl;
+  std::cout << "- filter: " << filter << std::endl;
+  std::cout << "- cube map lod: " << cube_map_lod << std::endl;
+  std::cout << "- adaptive: " << adaptive << std::endl;
+  std::cout << "- adaptive min: " << adaptive_min << std::endl;
 }
 
 void ArgParser::SetDefaultValues() {
   input_file = "";
   output_file = "";
+  depth_file = "";
   normals_file = "";
+  ids_file = "";
+  heatmap_file = "";
+  depth_min = 0.0f;
+  depth_max = 1.0f;
   width = 200;
   height = 200;
 
   bounces = 0;
   shadows = false;
+  min_throughput = 0.0f;
+  roulette = 0;
+  light_cutoff = 0.0f;
+  light_samples = 0;
+  stats = false;
+  accel = "bvh";
+  accel_cache = "";
+  threads = 0;
+  packets = true;
+  wavefront = false;
+  stream_output = false;
+  render_region = false;
+  region_x0 = 0;
+  region_y0 = 0;
+  region_x1 = 0;
+  region_y1 = 0;
+  spp = 1;
+  time_budget = 0.0;
+  snapshot_every = 0.0;
+  jitter = false;
+  filter = false;
+  cube_map_lod = false;
+  adaptive = 0.0f;
+  adaptive_min = 4;
 }
@@ -11,6 +11,9 @@ class ArgParser {
   std::string output_file;
   std::string depth_file;
   std::string normals_file;
+  std::string ids_file;
+  // False-color image of each pixel's traversal cost (-heatmap).
+  std::string heatmap_file;
   size_t width;
   size_t height;
 
@@ -19,10 +22,61 @@ class ArgParser {
   float depth_max;
   size_t bounces;
   bool shadows;
+  // Path termination: throughput cutoff and the bounce from which Russian
+  // roulette applies (0 disables it).
+  float min_throughput;
+  size_t roulette;
+  // Many lights: intensity below which point lights are culled, and the
+  // number of point lights sampled per hit (0 for all).
+  float light_cutoff;
+  size_t light_samples;
+  // Print ray counts and, in TRACER_STATS builds, traversal counters
+  // after rendering (-stats).
+  bool stats;
 
-  // Supersampling.
+  // Mesh acceleration structure: "bvh", "octree", or "lazy" for a BVH
+  // that builds its lower levels as rays first reach them.
+  std::string accel;
+
+  // Directory of the on-disk BVH cache; empty disables it.
+  std::string accel_cache;
+
+  // Number of render threads; 0 means one per hardware thread.
+  size_t threads;
+
+  // Trace primary rays in 2x2 packets; -no-packets traces them one by one.
+  bool packets;
+  // Render with the wavefront engine (-wavefront), which runs each stage
+  // of the paths over a batch of pixels at a time.
+  bool wavefront;
+  // Write the output one band of rows at a time as it finishes
+  // (-stream-output) instead of keeping the whole image in memory.
+  bool stream_output;
+  // Render only the pixels [region_x0, region_x1) x [region_y0, region_y1)
+  // of the output image, counted from its top left corner, into a tile
+  // file for the merge_tiles tool (-region x0 y0 x1 y1).
+  bool render_region;
+  size_t region_x0;
+  size_t region_y0;
+  size_t region_x1;
+  size_t region_y1;
+
+  // Progressive rendering: samples per pixel, and seconds after which to
+  // stop and between snapshots of the output (0 for none).
+  size_t spp;
+  double time_budget;
+  double snapshot_every;
+
+  // Supersampling: stratified jitter, a tent blur of the pixel means
+  // (see SamplingSpec::filter), and adaptive sampling that stops a pixel
+  // once the standard error of its luminance is below adaptive (0
+  // disables it) after adaptive_min samples.
   bool jitter;
   bool filter;
+  // Mip-mapped cube map lookups (-cube-map-lod).
+  bool cube_map_lod;
+  float adaptive;
+  size_t adaptive_min;
 
  private:
   void SetDefaultValues();
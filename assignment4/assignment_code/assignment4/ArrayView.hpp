@@ -0,0 +1,46 @@
+#ifndef ARRAY_VIEW_H_
+#define ARRAY_VIEW_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace GLOO {
+// Read-only view of a contiguous array owned elsewhere, such as a
+// std::vector or a memory-mapped file. The owner must outlive the view.
+template <typename T>
+class ArrayView {
+ public:
+  ArrayView() : data_(nullptr), size_(0) {
+  }
+  ArrayView(const T* data, size_t size) : data_(data), size_(size) {
+  }
+  ArrayView(const std::vector<T>& vector)
+      : data_(vector.data()), size_(vector.size()) {
+  }
+
+  const T& operator[](size_t i) const {
+    return data_[i];
+  }
+  const T* data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+  const T* begin() const {
+    return data_;
+  }
+  const T* end() const {
+    return data_ + size_;
+  }
+
+ private:
+  const T* data_;
+  size_t size_;
+};
+}  // namespace GLOO
+
+#endif
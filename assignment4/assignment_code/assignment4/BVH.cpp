@@ -0,0 +1,459 @@
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+#include "hittable/Mesh.hpp"
+#include "TraceStats.hpp"
+
+namespace {
+// Number of centroid bins evaluated per axis when searching for a split.
+const int kNumBins = 12;
+// Cost of visiting a node relative to testing one primitive.
+const float kTraversalCost = 1.0f;
+// Leaves larger than this are split even when SAH says otherwise.
+const uint32_t kMaxLeafSizeHard = 64;
+// Subtrees smaller than this are not worth a thread of their own.
+const uint32_t kParallelBuildMinPrims = 4096;
+}  // namespace
+
+namespace GLOO {
+struct BVH::BuildState {
+  explicit BuildState(const std::vector<BuildPrim>& build_prims)
+      : prims(build_prims) {
+  }
+
+  const std::vector<BuildPrim>& prims;
+  // Preallocated for the worst case of 2n - 1 nodes; threads claim pairs
+  // of sibling slots with arena_size.
+  std::vector<BuildNodeRecord> arena;
+  std::atomic<uint32_t> arena_size;
+};
+
+void BVH::Build(const Mesh& mesh) {
+  std::vector<uint32_t> triangles(mesh.GetNumTriangles());
+  std::iota(triangles.begin(), triangles.end(), 0);
+  Build(mesh, triangles);
+}
+
+void BVH::Build(const Mesh& mesh, const std::vector<uint32_t>& triangles) {
+  mesh_ = &mesh;
+  // Leaves are tested a whole block at a time, so a leaf costs the same
+  // for any triangle count up to the block width.
+  prim_group_size_ = kTriangleBlockWidth;
+  std::vector<AABB> prim_bounds(triangles.size());
+  for (size_t i = 0; i < prim_bounds.size(); i++) {
+    prim_bounds[i] = mesh.GetTriangleBounds(triangles[i]);
+  }
+  BuildFromBounds(prim_bounds);
+  // Leaves now refer to positions in triangles; make them mesh triangles.
+  for (uint32_t& index : prim_index_storage_) {
+    index = triangles[index];
+  }
+  PackTriangleBlocks();
+  UpdateViews();
+}
+
+void BVH::BuildFromBounds(const std::vector<AABB>& prim_bounds) {
+  if (prim_bounds.empty()) {
+    throw std::runtime_error("Cannot build a BVH without primitives!");
+  }
+  block_storage_.clear();
+  std::vector<BuildPrim> prims(prim_bounds.size());
+  prim_index_storage_.resize(prim_bounds.size());
+  for (size_t i = 0; i < prim_bounds.size(); i++) {
+    prims[i].bounds = prim_bounds[i];
+    prims[i].centroid = prim_bounds[i].GetCenter();
+    prim_index_storage_[i] = static_cast<uint32_t>(i);
+  }
+
+  BuildState state(prims);
+  state.arena.resize(2 * prims.size());
+  state.arena_size = 1;
+  size_t num_threads = num_build_threads_;
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  BuildNode(state, 0, 0, static_cast<uint32_t>(prims.size()), 0, num_threads);
+
+  node_storage_.clear();
+  node_storage_.reserve(state.arena_size);
+  Flatten(state, 0);
+  UpdateViews();
+}
+
+void BVH::BuildNode(BuildState& state,
+                    uint32_t node_index,
+                    uint32_t begin,
+                    uint32_t end,
+                    int depth,
+                    size_t num_threads) {
+  AABB bounds = AABB::Empty();
+  AABB centroid_bounds = AABB::Empty();
+  for (uint32_t i = begin; i < end; i++) {
+    const BuildPrim& prim = state.prims[prim_index_storage_[i]];
+    bounds.UnionWith(prim.bounds);
+    centroid_bounds.Extend(prim.centroid);
+  }
+  BuildNodeRecord& node = state.arena[node_index];
+  node.bounds = bounds;
+
+  uint32_t count = end - begin;
+  auto make_leaf = [&]() {
+    node.begin = begin;
+    node.count = count;
+  };
+  if (count <= 1 || depth + 1 >= kMaxDepth) {
+    make_leaf();
+    return;
+  }
+
+  // Binned SAH: bucket centroids along each axis and sweep the bucket
+  // boundaries for the cheapest split.
+  float best_cost = std::numeric_limits<float>::max();
+  int best_axis = -1;
+  int best_bin = 0;
+  glm::vec3 extent = centroid_bounds.mx - centroid_bounds.mn;
+  for (int axis = 0; axis < 3; axis++) {
+    if (extent[axis] <= 0.0f) {
+      continue;
+    }
+    float scale = kNumBins / extent[axis];
+    uint32_t bin_counts[kNumBins] = {};
+    AABB bin_bounds[kNumBins];
+    for (int b = 0; b < kNumBins; b++) {
+      bin_bounds[b] = AABB::Empty();
+    }
+    for (uint32_t i = begin; i < end; i++) {
+      const BuildPrim& prim = state.prims[prim_index_storage_[i]];
+      int b = std::min(
+          kNumBins - 1,
+          int((prim.centroid[axis] - centroid_bounds.mn[axis]) * scale));
+      bin_counts[b]++;
+      bin_bounds[b].UnionWith(prim.bounds);
+    }
+
+    // right_area[b] / right_count[b] describe bins [b, kNumBins).
+    float right_area[kNumBins];
+    uint32_t right_count[kNumBins];
+    AABB accum = AABB::Empty();
+    uint32_t accum_count = 0;
+    for (int b = kNumBins - 1; b > 0; b--) {
+      accum.UnionWith(bin_bounds[b]);
+      accum_count += bin_counts[b];
+      right_area[b] = accum_count ? accum.GetSurfaceArea() : 0.0f;
+      right_count[b] = accum_count;
+    }
+    accum = AABB::Empty();
+    accum_count = 0;
+    for (int b = 1; b < kNumBins; b++) {
+      accum.UnionWith(bin_bounds[b - 1]);
+      accum_count += bin_counts[b - 1];
+      if (accum_count == 0 || right_count[b] == 0) {
+        continue;
+      }
+      float cost = CountGroups(accum_count) * accum.GetSurfaceArea() +
+                   CountGroups(right_count[b]) * right_area[b];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_bin = b;
+      }
+    }
+  }
+
+  uint32_t mid;
+  if (best_axis < 0) {
+    // All centroids coincide; split by index if the leaf would be too big.
+    if (count <= kMaxLeafSizeHard) {
+      make_leaf();
+      return;
+    }
+    mid = begin + count / 2;
+  } else {
+    float leaf_cost = CountGroups(count) * bounds.GetSurfaceArea();
+    float split_cost = kTraversalCost * bounds.GetSurfaceArea() + best_cost;
+    if (count <= std::max<size_t>(max_leaf_size_, prim_group_size_) &&
+        split_cost >= leaf_cost) {
+      make_leaf();
+      return;
+    }
+    float scale = kNumBins / extent[best_axis];
+    float axis_min = centroid_bounds.mn[best_axis];
+    uint32_t* split = std::partition(
+        prim_index_storage_.data() + begin,
+        prim_index_storage_.data() + end,
+        [&](uint32_t index) {
+          const BuildPrim& prim = state.prims[index];
+          int b = std::min(
+              kNumBins - 1,
+              int((prim.centroid[best_axis] - axis_min) * scale));
+          return b < best_bin;
+        });
+    mid = static_cast<uint32_t>(split - prim_index_storage_.data());
+  }
+
+  // Subtrees cover disjoint ranges of the prim indices, so they can be
+  // built concurrently; large ones hand half of the threads to the left
+  // child.
+  uint32_t children = state.arena_size.fetch_add(2);
+  node.first_child = children;
+  node.count = 0;
+  if (num_threads > 1 && count >= kParallelBuildMinPrims) {
+    size_t left_threads = num_threads / 2;
+    std::thread left([&]() {
+      BuildNode(state, children, begin, mid, depth + 1, left_threads);
+    });
+    BuildNode(state, children + 1, mid, end, depth + 1,
+              num_threads - left_threads);
+    left.join();
+  } else {
+    BuildNode(state, children, begin, mid, depth + 1, 1);
+    BuildNode(state, children + 1, mid, end, depth + 1, 1);
+  }
+}
+
+uint32_t BVH::Flatten(const BuildState& state, uint32_t node_index) {
+  const BuildNodeRecord& record = state.arena[node_index];
+  uint32_t index = static_cast<uint32_t>(node_storage_.size());
+  node_storage_.emplace_back();
+  node_storage_[index].mn = record.bounds.mn;
+  node_storage_[index].mx = record.bounds.mx;
+  if (record.count > 0) {
+    node_storage_[index].offset = record.begin;
+    node_storage_[index].count = record.count;
+    return index;
+  }
+  // Left child directly follows its parent; the right child comes after
+  // the whole left subtree.
+  Flatten(state, record.first_child);
+  uint32_t right = Flatten(state, record.first_child + 1);
+  node_storage_[index].offset = right;
+  node_storage_[index].count = 0;
+  return index;
+}
+
+bool BVH::IntersectLeafBlocks(const BVHNode& leaf,
+                              const glm::vec3& origin,
+                              const glm::vec3& direction,
+                              float t_min,
+                              HitRecord& record) const {
+  TRACE_STATS_ADD(triangle_tests, leaf.count);
+  bool intersected = false;
+  uint32_t first = leaf.offset / kTriangleBlockWidth;
+  uint32_t last = (leaf.offset + leaf.count - 1) / kTriangleBlockWidth;
+  for (uint32_t b = first; b <= last; b++) {
+    const TriangleBlock& block = blocks_[b];
+    float t, beta, gamma;
+    int lane = IntersectTriangleBlockClosest(block, origin, direction, t_min,
+                                             record.time, kAllTriangleLanes,
+                                             t, beta, gamma);
+    if (lane >= 0) {
+      mesh_->RecordHit(block.ids[lane], t, beta, gamma, record);
+      intersected = true;
+    }
+  }
+  return intersected;
+}
+
+bool BVH::Intersect(const Ray& ray, float t_min, HitRecord& record) const {
+  return TraverseLeaves(
+      ray, t_min, record, [&](const BVHNode& leaf, HitRecord& rec) {
+        return IntersectLeafBlocks(leaf, ray.GetOrigin(), ray.GetDirection(),
+                                   t_min, rec);
+      });
+}
+
+unsigned BVH::IntersectPacket(const RayPacket& packet,
+                              float t_min,
+                              HitRecord* records) const {
+  return TraversePacket(
+      packet, t_min, records,
+      [&](const BVHNode& leaf, unsigned lanes, HitRecord* recs) {
+        unsigned intersected = 0;
+        for (int lane = 0; lane < kPacketSize; lane++) {
+          if ((lanes & (1u << lane)) &&
+              IntersectLeafBlocks(leaf, packet.origins[lane],
+                                  packet.directions[lane], t_min,
+                                  recs[lane])) {
+            intersected |= 1u << lane;
+          }
+        }
+        return intersected;
+      },
+      [&](int lane, const BVHNode& leaf, HitRecord& rec) {
+        return IntersectLeafBlocks(leaf, packet.origins[lane],
+                                   packet.directions[lane], t_min, rec);
+      });
+}
+
+bool BVH::Occluded(const Ray& ray, float t_min, float t_max) const {
+  const glm::vec3& origin = ray.GetOrigin();
+  const glm::vec3& direction = ray.GetDirection();
+  return TraverseLeavesAny(ray, t_min, t_max, [&](const BVHNode& leaf) {
+    TRACE_STATS_ADD(triangle_tests, leaf.count);
+    uint32_t first = leaf.offset / kTriangleBlockWidth;
+    uint32_t last = (leaf.offset + leaf.count - 1) / kTriangleBlockWidth;
+    for (uint32_t b = first; b <= last; b++) {
+      if (IntersectTriangleBlock(blocks_[b], origin, direction, t_min, t_max,
+                                 true, kAllTriangleLanes, nullptr, nullptr,
+                                 nullptr)) {
+        return true;
+      }
+    }
+    return false;
+  });
+}
+
+void BVH::PackTriangleBlocks() {
+  std::vector<uint32_t> packed;
+  packed.reserve(prim_index_storage_.size() +
+                 node_storage_.size() * kTriangleBlockWidth);
+  for (BVHNode& node : node_storage_) {
+    if (!node.IsLeaf()) {
+      continue;
+    }
+    uint32_t offset = static_cast<uint32_t>(packed.size());
+    packed.insert(packed.end(), prim_index_storage_.begin() + node.offset,
+                  prim_index_storage_.begin() + node.offset + node.count);
+    size_t padded = (packed.size() + kTriangleBlockWidth - 1) /
+                    kTriangleBlockWidth * kTriangleBlockWidth;
+    packed.resize(padded, kNoTriangle);
+    node.offset = offset;
+  }
+  packed.shrink_to_fit();
+  prim_index_storage_.swap(packed);
+
+  block_storage_.clear();
+  block_storage_.reserve(prim_index_storage_.size() / kTriangleBlockWidth);
+  AppendTriangleBlocks(*mesh_, prim_index_storage_.data(),
+                       prim_index_storage_.size(), block_storage_);
+}
+
+void BVH::Adopt(const Mesh& mesh,
+                ArrayView<BVHNode> nodes,
+                ArrayView<uint32_t> prim_indices,
+                ArrayView<TriangleBlock> blocks) {
+  mesh_ = &mesh;
+  prim_group_size_ = kTriangleBlockWidth;
+  node_storage_.clear();
+  prim_index_storage_.clear();
+  block_storage_.clear();
+  nodes_ = nodes;
+  prim_indices_ = prim_indices;
+  blocks_ = blocks;
+}
+
+void BVH::Clear() {
+  mesh_ = nullptr;
+  node_storage_.clear();
+  prim_index_storage_.clear();
+  block_storage_.clear();
+  UpdateViews();
+}
+
+bool BVH::IsValidLayout(ArrayView<BVHNode> nodes,
+                        ArrayView<uint32_t> prim_indices,
+                        ArrayView<TriangleBlock> blocks,
+                        size_t num_triangles) {
+  if (nodes.empty() || num_triangles == 0 ||
+      nodes.size() > 2 * num_triangles - 1 ||
+      prim_indices.size() !=
+          blocks.size() * static_cast<size_t>(kTriangleBlockWidth)) {
+    return false;
+  }
+  for (size_t i = 0; i < prim_indices.size(); i++) {
+    const TriangleBlock& block = blocks[i / kTriangleBlockWidth];
+    int lane = static_cast<int>(i % kTriangleBlockWidth);
+    uint32_t id = prim_indices[i];
+    if (block.ids[lane] != id) {
+      return false;
+    }
+    // Empty lanes are only safe while their zero edges keep the kernel
+    // from ever reporting them.
+    if (id == kNoTriangle) {
+      for (int dim = 0; dim < 3; dim++) {
+        if (block.e1[dim][lane] != 0.0f || block.e2[dim][lane] != 0.0f) {
+          return false;
+        }
+      }
+    } else if (id >= num_triangles) {
+      return false;
+    }
+  }
+
+  // Walking the tree depth-first must visit the nodes in array order, so
+  // every node is reached exactly once and children follow their parent.
+  struct Entry {
+    uint32_t node;
+    int depth;
+  };
+  std::vector<Entry> stack;
+  stack.push_back({0, 1});
+  size_t next = 0;
+  while (!stack.empty()) {
+    Entry entry = stack.back();
+    stack.pop_back();
+    if (entry.node != next || entry.depth > kMaxDepth) {
+      return false;
+    }
+    next++;
+    const BVHNode& node = nodes[entry.node];
+    if (node.IsLeaf()) {
+      if (uint64_t(node.offset) + node.count > prim_indices.size()) {
+        return false;
+      }
+    } else {
+      if (uint64_t(entry.node) + 1 >= nodes.size() ||
+          node.offset <= entry.node + 1 || node.offset >= nodes.size()) {
+        return false;
+      }
+      stack.push_back({node.offset, entry.depth + 1});
+      stack.push_back({entry.node + 1, entry.depth + 1});
+    }
+  }
+  return next == nodes.size();
+}
+
+void BVH::UpdateViews() {
+  nodes_ = node_storage_;
+  prim_indices_ = prim_index_storage_;
+  blocks_ = block_storage_;
+}
+
+void BVH::Refit(const std::vector<AABB>& prim_bounds) {
+  if (node_storage_.size() != nodes_.size()) {
+    throw std::runtime_error("Cannot refit a BVH over borrowed nodes!");
+  }
+  // Children always come after their parent, so a reverse sweep sees both
+  // children of a node before the node itself.
+  for (size_t i = node_storage_.size(); i-- > 0;) {
+    BVHNode& node = node_storage_[i];
+    AABB bounds = AABB::Empty();
+    if (node.IsLeaf()) {
+      for (uint32_t k = node.offset; k < node.offset + node.count; k++) {
+        bounds.UnionWith(prim_bounds[prim_indices_[k]]);
+      }
+    } else {
+      const BVHNode& left = node_storage_[i + 1];
+      const BVHNode& right = node_storage_[node.offset];
+      bounds = AABB(glm::min(left.mn, right.mn), glm::max(left.mx, right.mx));
+    }
+    node.mn = bounds.mn;
+    node.mx = bounds.mx;
+  }
+}
+
+size_t BVH::GetMemoryUsage() const {
+  // Counts borrowed arrays too: mapped pages are resident once touched.
+  return std::max(node_storage_.capacity(), nodes_.size()) * sizeof(BVHNode) +
+         std::max(prim_index_storage_.capacity(), prim_indices_.size()) *
+             sizeof(uint32_t) +
+         std::max(block_storage_.capacity(), blocks_.size()) *
+             sizeof(TriangleBlock);
+}
+}  // namespace GLOO
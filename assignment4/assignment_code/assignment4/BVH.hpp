@@ -0,0 +1,450 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "AABB.hpp"
+#include "AccelStructure.hpp"
+#include "ArrayView.hpp"
+#include "TraceStats.hpp"
+#include "TriangleBlock.hpp"
+
+namespace GLOO {
+// Nodes are stored depth-first in one array: an interior node's left child
+// immediately follows it and `offset` is the index of its right child. A
+// leaf covers prim_indices_[offset, offset + count).
+struct BVHNode {
+  bool IsLeaf() const {
+    return count > 0;
+  }
+
+  glm::vec3 mn;
+  uint32_t offset;
+  glm::vec3 mx;
+  uint32_t count;
+};
+static_assert(sizeof(BVHNode) == 32, "BVHNode must stay 32 bytes");
+
+// Slab test; writes the entry distance of the overlap of the ray with the
+// box and [t_min, t_max].
+inline bool IntersectBox(const glm::vec3& mn,
+                         const glm::vec3& mx,
+                         const glm::vec3& origin,
+                         const glm::vec3& inv_dir,
+                         float t_min,
+                         float t_max,
+                         float& t_entry) {
+  glm::vec3 t0 = (mn - origin) * inv_dir;
+  glm::vec3 t1 = (mx - origin) * inv_dir;
+  glm::vec3 t_near = glm::min(t0, t1);
+  glm::vec3 t_far = glm::max(t0, t1);
+  t_entry = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, t_min));
+  float t_exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, t_max));
+  return t_entry <= t_exit;
+}
+
+// Bounding volume hierarchy built with binned SAH. Unlike the Octree, each
+// triangle is referenced by exactly one leaf.
+class BVH : public AccelStructure {
+ public:
+  // Traversal keeps one stack entry per level, so the build stops
+  // splitting before the tree gets deeper than this.
+  static const int kMaxDepth = 64;
+
+  // num_build_threads = 0 builds with one thread per hardware thread.
+  BVH(size_t max_leaf_size = 4, size_t num_build_threads = 0)
+      : max_leaf_size_(max_leaf_size), num_build_threads_(num_build_threads) {
+  }
+  // Traversal reads through views into this object's own arrays.
+  BVH(const BVH&) = delete;
+  BVH& operator=(const BVH&) = delete;
+
+  void Build(const Mesh& mesh) override;
+  // Builds over the given triangles of mesh only.
+  void Build(const Mesh& mesh, const std::vector<uint32_t>& triangles);
+  bool Intersect(const Ray& ray,
+                 float t_min,
+                 HitRecord& record) const override;
+  bool Occluded(const Ray& ray, float t_min, float t_max) const override;
+  unsigned IntersectPacket(const RayPacket& packet,
+                           float t_min,
+                           HitRecord* records) const override;
+  size_t GetMemoryUsage() const override;
+
+  // Builds over arbitrary primitives; leaves then refer to indices into
+  // prim_bounds.
+  void BuildFromBounds(const std::vector<AABB>& prim_bounds);
+  // Drops every node, leaving a BVH that no ray hits.
+  void Clear();
+  // Recomputes node bounds for moved primitives, keeping the topology.
+  void Refit(const std::vector<AABB>& prim_bounds);
+
+  // Traces mesh with arrays built earlier by Build and kept elsewhere,
+  // e.g. in a mapped cache file, without copying them. They must outlive
+  // the BVH.
+  void Adopt(const Mesh& mesh,
+             ArrayView<BVHNode> nodes,
+             ArrayView<uint32_t> prim_indices,
+             ArrayView<TriangleBlock> blocks);
+  // Whether the arrays form a tree laid out as Build lays it out over a
+  // mesh of num_triangles triangles: depth-first, at most kMaxDepth deep,
+  // with leaf ranges, triangle ids and blocks that traversal can follow
+  // without leaving the arrays. Takes one pass over them.
+  static bool IsValidLayout(ArrayView<BVHNode> nodes,
+                            ArrayView<uint32_t> prim_indices,
+                            ArrayView<TriangleBlock> blocks,
+                            size_t num_triangles);
+  ArrayView<BVHNode> GetNodes() const {
+    return nodes_;
+  }
+  ArrayView<uint32_t> GetPrimIndices() const {
+    return prim_indices_;
+  }
+  ArrayView<TriangleBlock> GetBlocks() const {
+    return blocks_;
+  }
+
+  // Visits leaves nearest-first and calls
+  // intersect_prim(prim_index, record) for each primitive in them; the
+  // callback returns whether it recorded a closer hit.
+  template <typename IntersectPrim>
+  bool Traverse(const Ray& ray,
+                float t_min,
+                HitRecord& record,
+                IntersectPrim intersect_prim) const;
+  // Leaf-level versions of Traverse and TraverseAny: the callbacks get
+  // the whole leaf node instead of one primitive at a time. TraverseLeaves
+  // can start from any subtree.
+  template <typename IntersectLeaf>
+  bool TraverseLeaves(const Ray& ray,
+                      float t_min,
+                      HitRecord& record,
+                      IntersectLeaf intersect_leaf,
+                      uint32_t root = 0) const;
+  template <typename OccludedLeaf>
+  bool TraverseLeavesAny(const Ray& ray,
+                         float t_min,
+                         float t_max,
+                         OccludedLeaf occluded_leaf) const;
+
+  // Primitive stored at position i of a leaf's [offset, offset + count).
+  uint32_t GetPrimIndex(uint32_t i) const {
+    return prim_indices_[i];
+  }
+
+  // Closest-hit traversal of the active rays of packet together. A node
+  // is entered with the lanes whose [t_min, records[lane].time] interval
+  // overlaps its box and skipped when there are none. Leaves reached by
+  // several lanes call intersect_leaf_packet(leaf, lanes, records); once
+  // only one lane is left in a subtree, that ray finishes it alone through
+  // intersect_leaf(lane, leaf, record). Returns the lanes that got a
+  // closer hit.
+  template <typename IntersectLeafPacket, typename IntersectLeaf>
+  unsigned TraversePacket(const RayPacket& packet,
+                          float t_min,
+                          HitRecord* records,
+                          IntersectLeafPacket intersect_leaf_packet,
+                          IntersectLeaf intersect_leaf) const;
+  // Any-hit traversal over boxes overlapping [t_min, t_max]; returns true
+  // as soon as occluded_prim(prim_index) does.
+  template <typename OccludedPrim>
+  bool TraverseAny(const Ray& ray,
+                   float t_min,
+                   float t_max,
+                   OccludedPrim occluded_prim) const;
+
+ private:
+  struct BuildPrim {
+    AABB bounds;
+    glm::vec3 centroid;
+  };
+  // Node of the hierarchy while it is being built, before Flatten lays it
+  // out depth-first in nodes_. Siblings are adjacent in the arena.
+  struct BuildNodeRecord {
+    AABB bounds;
+    uint32_t first_child;
+    uint32_t begin;
+    uint32_t count;
+  };
+  struct BuildState;
+  // Builds the subtree over prim_indices_[begin, end) into arena slot
+  // node_index, splitting the work over up to num_threads threads.
+  void BuildNode(BuildState& state,
+                 uint32_t node_index,
+                 uint32_t begin,
+                 uint32_t end,
+                 int depth,
+                 size_t num_threads);
+  // Appends the arena subtree at node_index to nodes_ in depth-first
+  // order and returns its index there.
+  uint32_t Flatten(const BuildState& state, uint32_t node_index);
+  // Re-lays prim_indices_ so every leaf starts on a block boundary and
+  // packs the mesh's triangles into blocks_ in that order.
+  void PackTriangleBlocks();
+  // Points the views at the storage vectors.
+  void UpdateViews();
+
+  bool IntersectLeafBlocks(const BVHNode& leaf,
+                           const glm::vec3& origin,
+                           const glm::vec3& direction,
+                           float t_min,
+                           HitRecord& record) const;
+
+  // SAH cost of testing count primitives that are tested
+  // prim_group_size_ at a time.
+  uint32_t CountGroups(uint32_t count) const {
+    return (count + prim_group_size_ - 1) / prim_group_size_;
+  }
+
+  size_t max_leaf_size_;
+  size_t num_build_threads_;
+  uint32_t prim_group_size_ = 1;
+  const Mesh* mesh_ = nullptr;
+  // Traversal reads the arrays through these views, which point either at
+  // the storage vectors filled by the build or at adopted memory.
+  ArrayView<BVHNode> nodes_;
+  ArrayView<uint32_t> prim_indices_;
+  // Mesh BVHs only: block k holds prim_indices_[k * kTriangleBlockWidth,
+  // (k + 1) * kTriangleBlockWidth), padding included.
+  ArrayView<TriangleBlock> blocks_;
+  std::vector<BVHNode> node_storage_;
+  std::vector<uint32_t> prim_index_storage_;
+  std::vector<TriangleBlock> block_storage_;
+};
+
+template <typename IntersectPrim>
+bool BVH::Traverse(const Ray& ray,
+                   float t_min,
+                   HitRecord& record,
+                   IntersectPrim intersect_prim) const {
+  return TraverseLeaves(
+      ray, t_min, record, [&](const BVHNode& leaf, HitRecord& rec) {
+        bool intersected = false;
+        for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+          intersected |= intersect_prim(prim_indices_[i], rec);
+        }
+        return intersected;
+      });
+}
+
+template <typename OccludedPrim>
+bool BVH::TraverseAny(const Ray& ray,
+                      float t_min,
+                      float t_max,
+                      OccludedPrim occluded_prim) const {
+  return TraverseLeavesAny(ray, t_min, t_max, [&](const BVHNode& leaf) {
+    for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+      if (occluded_prim(prim_indices_[i])) {
+        return true;
+      }
+    }
+    return false;
+  });
+}
+
+template <typename IntersectLeaf>
+bool BVH::TraverseLeaves(const Ray& ray,
+                         float t_min,
+                         HitRecord& record,
+                         IntersectLeaf intersect_leaf,
+                         uint32_t root) const {
+  struct StackEntry {
+    uint32_t node;
+    float t_entry;
+  };
+
+  const glm::vec3& origin = ray.GetOrigin();
+  glm::vec3 inv_dir = 1.0f / ray.GetDirection();
+
+  bool intersected = false;
+  StackEntry stack[kMaxDepth];
+  int stack_size = 0;
+  uint32_t current = root;
+  float t_entry;
+  if (nodes_.empty() ||
+      !IntersectBox(nodes_[root].mn, nodes_[root].mx, origin, inv_dir, t_min,
+                    record.time, t_entry)) {
+    return false;
+  }
+
+  while (true) {
+    const BVHNode& node = nodes_[current];
+    TRACE_STATS_INC(node_visits);
+    if (node.IsLeaf()) {
+      intersected |= intersect_leaf(node, record);
+    } else {
+      uint32_t near = current + 1;
+      uint32_t far = node.offset;
+      float t_near, t_far;
+      bool hit_near = IntersectBox(nodes_[near].mn, nodes_[near].mx, origin,
+                                   inv_dir, t_min, record.time, t_near);
+      bool hit_far = IntersectBox(nodes_[far].mn, nodes_[far].mx, origin,
+                                  inv_dir, t_min, record.time, t_far);
+      if (hit_near && hit_far) {
+        if (t_far < t_near) {
+          std::swap(near, far);
+          std::swap(t_near, t_far);
+        }
+        stack[stack_size].node = far;
+        stack[stack_size].t_entry = t_far;
+        stack_size++;
+        current = near;
+        continue;
+      } else if (hit_near) {
+        current = near;
+        continue;
+      } else if (hit_far) {
+        current = far;
+        continue;
+      }
+    }
+
+    // Skip deferred subtrees that start beyond the closest hit so far.
+    do {
+      if (stack_size == 0) {
+        return intersected;
+      }
+      stack_size--;
+    } while (stack[stack_size].t_entry > record.time);
+    current = stack[stack_size].node;
+  }
+}
+
+template <typename IntersectLeafPacket, typename IntersectLeaf>
+unsigned BVH::TraversePacket(const RayPacket& packet,
+                             float t_min,
+                             HitRecord* records,
+                             IntersectLeafPacket intersect_leaf_packet,
+                             IntersectLeaf intersect_leaf) const {
+  if (nodes_.empty() || packet.mask == 0) {
+    return 0;
+  }
+  glm::vec3 inv_dirs[kPacketSize];
+  for (int lane = 0; lane < kPacketSize; lane++) {
+    if (packet.mask & (1u << lane)) {
+      inv_dirs[lane] = 1.0f / packet.directions[lane];
+    }
+  }
+
+  unsigned intersected = 0;
+  uint32_t stack[kMaxDepth];
+  int stack_size = 0;
+  uint32_t current = 0;
+  while (true) {
+    const BVHNode& node = nodes_[current];
+    // Records only get closer, so lanes culled here stay culled for the
+    // whole subtree.
+    unsigned lanes = 0;
+    for (int lane = 0; lane < kPacketSize; lane++) {
+      float t_entry;
+      if ((packet.mask & (1u << lane)) &&
+          IntersectBox(node.mn, node.mx, packet.origins[lane],
+                       inv_dirs[lane], t_min, records[lane].time, t_entry)) {
+        lanes |= 1u << lane;
+      }
+    }
+
+    if ((lanes & (lanes - 1)) == 0 && lanes != 0) {
+      int lane = 0;
+      while (!(lanes & (1u << lane))) {
+        lane++;
+      }
+      if (TraverseLeaves(packet.GetRay(lane), t_min, records[lane],
+                         [&](const BVHNode& leaf, HitRecord& record) {
+                           return intersect_leaf(lane, leaf, record);
+                         },
+                         current)) {
+        intersected |= lanes;
+      }
+    } else if (lanes != 0) {
+      TRACE_STATS_INC(node_visits);
+      if (node.IsLeaf()) {
+        intersected |= intersect_leaf_packet(node, lanes, records);
+      } else {
+        // Visit first the child on the side the rays come from, judged by
+        // the first active ray along the axis the children differ most.
+        uint32_t near = current + 1;
+        uint32_t far = node.offset;
+        glm::vec3 offset = (nodes_[far].mn + nodes_[far].mx) -
+                           (nodes_[near].mn + nodes_[near].mx);
+        glm::vec3 extent = glm::abs(offset);
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                       : (extent.y > extent.z ? 1 : 2);
+        int first = 0;
+        while (!(lanes & (1u << first))) {
+          first++;
+        }
+        if (packet.directions[first][axis] * offset[axis] < 0.0f) {
+          std::swap(near, far);
+        }
+        stack[stack_size++] = far;
+        current = near;
+        continue;
+      }
+    }
+
+    if (stack_size == 0) {
+      return intersected;
+    }
+    current = stack[--stack_size];
+  }
+}
+
+template <typename OccludedLeaf>
+bool BVH::TraverseLeavesAny(const Ray& ray,
+                            float t_min,
+                            float t_max,
+                            OccludedLeaf occluded_leaf) const {
+  const glm::vec3& origin = ray.GetOrigin();
+  glm::vec3 inv_dir = 1.0f / ray.GetDirection();
+
+  uint32_t stack[kMaxDepth];
+  int stack_size = 0;
+  uint32_t current = 0;
+  float t_entry;
+  if (nodes_.empty() ||
+      !IntersectBox(nodes_[0].mn, nodes_[0].mx, origin, inv_dir, t_min, t_max,
+                    t_entry)) {
+    return false;
+  }
+
+  while (true) {
+    const BVHNode& node = nodes_[current];
+    TRACE_STATS_INC(node_visits);
+    if (node.IsLeaf()) {
+      if (occluded_leaf(node)) {
+        return true;
+      }
+    } else {
+      uint32_t left = current + 1;
+      uint32_t right = node.offset;
+      bool hit_left = IntersectBox(nodes_[left].mn, nodes_[left].mx, origin,
+                                   inv_dir, t_min, t_max, t_entry);
+      bool hit_right = IntersectBox(nodes_[right].mn, nodes_[right].mx,
+                                    origin, inv_dir, t_min, t_max, t_entry);
+      if (hit_left && hit_right) {
+        stack[stack_size++] = right;
+        current = left;
+        continue;
+      } else if (hit_left) {
+        current = left;
+        continue;
+      } else if (hit_right) {
+        current = right;
+        continue;
+      }
+    }
+
+    if (stack_size == 0) {
+      return false;
+    }
+    current = stack[--stack_size];
+  }
+}
+}  // namespace GLOO
+
+#endif
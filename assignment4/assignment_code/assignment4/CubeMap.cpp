@@ -5,6 +5,16 @@
 #include <iostream>
 #include <algorithm>
 
+#include "gloo/Image.hpp"
+
+// Texels are unpacked and filtered four channels at a time with SSE2
+// where it is available.
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CUBE_MAP_SSE
+#endif
+
 namespace {
 enum FACE {
   LEFT,
@@ -14,29 +24,151 @@ enum FACE {
   FRONT,
   BACK,
 };
+
+uint32_t PackRGB8(const glm::vec3& color) {
+  uint32_t packed = 0;
+  for (int i = 0; i < 3; i++) {
+    float v = std::min(std::max(color[i], 0.0f), 1.0f);
+    packed |= uint32_t(v * 255.0f + 0.5f) << (8 * i);
+  }
+  return packed;
+}
+
+#ifndef CUBE_MAP_SSE
+// The 8-bit to float conversion of Image::LoadPNG, as a table.
+struct ByteToFloat {
+  ByteToFloat() {
+    for (int i = 0; i < 256; i++) {
+      values[i] = static_cast<float>(i) / 255.0f;
+    }
+  }
+  float values[256];
+};
+const ByteToFloat kByteToFloat;
+
+glm::vec3 UnpackRGB8(uint32_t packed) {
+  return glm::vec3(kByteToFloat.values[packed & 0xff],
+                   kByteToFloat.values[(packed >> 8) & 0xff],
+                   kByteToFloat.values[(packed >> 16) & 0xff]);
 }
+#endif
+}  // namespace
 
 namespace GLOO {
 CubeMap::CubeMap(const std::string& directory) {
   std::string side[6] = {"left", "right", "up", "down", "front", "back"};
   for (int i = 0; i < 6; i++) {
     std::string filename = directory + "/" + side[i] + ".png";
-    images_[i] = Image::LoadPNG(filename, false);
+    std::unique_ptr<Image> image = Image::LoadPNG(filename, false);
+
+    // Level 0 holds the image's texels; every further level averages 2x2
+    // texels of the one before, down to 1x1.
+    int width = static_cast<int>(image->GetWidth());
+    int height = static_cast<int>(image->GetHeight());
+    std::vector<glm::vec3> colors(width * height);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        colors[y * width + x] = image->GetPixel(x, y);
+      }
+    }
+    while (true) {
+      Level level;
+      level.width = width;
+      level.height = height;
+      level.tiles_per_row = (width + kTileSize - 1) / kTileSize;
+      int tile_rows = (height + kTileSize - 1) / kTileSize;
+      level.texels.assign(
+          size_t(level.tiles_per_row) * tile_rows * kTileSize * kTileSize, 0);
+      for (int y = 0; y < height; y++) {
+        uint32_t* row = &level.texels[(size_t(y / kTileSize) *
+                                           level.tiles_per_row * kTileSize +
+                                       y % kTileSize) *
+                                      kTileSize];
+        const glm::vec3* colors_row = &colors[size_t(y) * width];
+        for (int x = 0; x < width; x++) {
+          row[(x / kTileSize) * kTileSize * kTileSize + x % kTileSize] =
+              PackRGB8(colors_row[x]);
+        }
+      }
+      faces_[i].push_back(std::move(level));
+      if (width == 1 && height == 1) {
+        break;
+      }
+
+      int next_width = std::max(1, width / 2);
+      int next_height = std::max(1, height / 2);
+      std::vector<glm::vec3> next_colors(next_width * next_height);
+      for (int y = 0; y < next_height; y++) {
+        const glm::vec3* row0 = &colors[size_t(2 * y) * width];
+        const glm::vec3* row1 =
+            &colors[size_t(std::min(2 * y + 1, height - 1)) * width];
+        for (int x = 0; x < next_width; x++) {
+          int x1 = std::min(2 * x + 1, width - 1);
+          next_colors[y * next_width + x] =
+              0.25f * (row0[2 * x] + row0[x1] + row1[2 * x] + row1[x1]);
+        }
+      }
+      width = next_width;
+      height = next_height;
+      colors.swap(next_colors);
+    }
   }
 }
 
-glm::vec3 CubeMap::GetFaceTexel(float x, float y, int face) const {
-  x = x * images_[face]->GetWidth();
-  y = (1 - y) * images_[face]->GetHeight();
+uint32_t CubeMap::Level::GetTexel(unsigned x, unsigned y) const {
+  size_t tile = size_t(y / kTileSize) * tiles_per_row + x / kTileSize;
+  return texels[tile * kTileSize * kTileSize + (y % kTileSize) * kTileSize +
+                x % kTileSize];
+}
+
+glm::vec3 CubeMap::GetFaceTexel(float x, float y, int face, int level) const {
+  const Level& texture = faces_[face][level];
+  x = x * texture.width;
+  y = (1 - y) * texture.height;
   int ix = (int)x;
   int iy = (int)y;
   float alpha = x - ix;
   float beta = y - iy;
 
-  const glm::vec3& pixel0 = GetTexturePixel(ix + 0, iy + 0, face);
-  const glm::vec3& pixel1 = GetTexturePixel(ix + 1, iy + 0, face);
-  const glm::vec3& pixel2 = GetTexturePixel(ix + 0, iy + 1, face);
-  const glm::vec3& pixel3 = GetTexturePixel(ix + 1, iy + 1, face);
+  // Lookups past the edges clamp to the edge texels.
+  unsigned x0 = std::min(std::max(0, ix), texture.width - 1);
+  unsigned x1 = std::min(std::max(0, ix + 1), texture.width - 1);
+  unsigned y0 = std::min(std::max(0, iy), texture.height - 1);
+  unsigned y1 = std::min(std::max(0, iy + 1), texture.height - 1);
+  uint32_t texel0 = texture.GetTexel(x0, y0);
+  uint32_t texel1 = texture.GetTexel(x1, y0);
+  uint32_t texel2 = texture.GetTexel(x0, y1);
+  uint32_t texel3 = texture.GetTexel(x1, y1);
+
+#ifdef CUBE_MAP_SSE
+  // Same operations in the same order as the loop below, so both give
+  // identical results.
+  __m128i zero = _mm_setzero_si128();
+  __m128i texels = _mm_set_epi32(int(texel3), int(texel2), int(texel1),
+                                 int(texel0));
+  __m128i texels01 = _mm_unpacklo_epi8(texels, zero);
+  __m128i texels23 = _mm_unpackhi_epi8(texels, zero);
+  __m128 scale = _mm_set1_ps(255.0f);
+  __m128 pixel0 =
+      _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(texels01, zero)), scale);
+  __m128 pixel1 =
+      _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(texels01, zero)), scale);
+  __m128 pixel2 =
+      _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(texels23, zero)), scale);
+  __m128 pixel3 =
+      _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(texels23, zero)), scale);
+  __m128 sum = _mm_mul_ps(_mm_set1_ps((1 - alpha) * (1 - beta)), pixel0);
+  sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(alpha * (1 - beta)), pixel1));
+  sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps((1 - alpha) * beta), pixel2));
+  sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(alpha * beta), pixel3));
+  float channels[4];
+  _mm_storeu_ps(channels, sum);
+  return glm::vec3(channels[0], channels[1], channels[2]);
+#else
+  glm::vec3 pixel0 = UnpackRGB8(texel0);
+  glm::vec3 pixel1 = UnpackRGB8(texel1);
+  glm::vec3 pixel2 = UnpackRGB8(texel2);
+  glm::vec3 pixel3 = UnpackRGB8(texel3);
 
   glm::vec3 color;
   for (int i = 0; i < 3; i++) {
@@ -46,46 +178,108 @@ glm::vec3 CubeMap::GetFaceTexel(float x, float y, int face) const {
   }
 
   return color;
+#endif
 }
 
-glm::vec3 CubeMap::GetTexel(const glm::vec3& direction) const {
+glm::vec3 CubeMap::GetFaceTexel(const FaceCoords& coords, float lod) const {
+  if (coords.face < 0) {
+    return glm::vec3(0.0f);
+  }
+  if (!(lod > 0.0f)) {
+    return GetFaceTexel(coords.x, coords.y, coords.face, 0);
+  }
+  int max_level = static_cast<int>(faces_[coords.face].size()) - 1;
+  lod = std::min(lod, float(max_level));
+  int level = static_cast<int>(lod);
+  float blend = lod - level;
+  glm::vec3 color = GetFaceTexel(coords.x, coords.y, coords.face, level);
+  if (blend > 0.0f) {
+    glm::vec3 coarse =
+        GetFaceTexel(coords.x, coords.y, coords.face, level + 1);
+    color = (1 - blend) * color + blend * coarse;
+  }
+  return color;
+}
+
+CubeMap::FaceCoords CubeMap::Project(const glm::vec3& direction) {
   glm::vec3 dir = glm::normalize(direction);
-  glm::vec3 outputColor(0.0f);
+  FaceCoords coords = {-1, 0.0f, 0.0f};
   if ((std::abs(dir[0]) >= std::abs(dir[1])) &&
       (std::abs(dir[0]) >= std::abs(dir[2]))) {
     if (dir[0] > 0.0f) {
-      outputColor = GetFaceTexel((dir[2] / dir[0] + 1.0f) * 0.5f,
-                                 (dir[1] / dir[0] + 1.0f) * 0.5f, RIGHT);
+      coords = {RIGHT, (dir[2] / dir[0] + 1.0f) * 0.5f,
+                (dir[1] / dir[0] + 1.0f) * 0.5f};
     } else if (dir[0] < 0.0f) {
-      outputColor = GetFaceTexel((dir[2] / dir[0] + 1.0f) * 0.5f,
-                                 1.0f - (dir[1] / dir[0] + 1.0f) * 0.5f, LEFT);
+      coords = {LEFT, (dir[2] / dir[0] + 1.0f) * 0.5f,
+                1.0f - (dir[1] / dir[0] + 1.0f) * 0.5f};
     }
   } else if ((std::abs(dir[1]) >= std::abs(dir[0])) &&
              (std::abs(dir[1]) >= std::abs(dir[2]))) {
     if (dir[1] > 0.0f) {
-      outputColor = GetFaceTexel((dir[0] / dir[1] + 1.0f) * 0.5f,
-                                 (dir[2] / dir[1] + 1.0f) * 0.5f, UP);
+      coords = {UP, (dir[0] / dir[1] + 1.0f) * 0.5f,
+                (dir[2] / dir[1] + 1.0f) * 0.5f};
     } else if (dir[1] < 0.0f) {
-      outputColor = GetFaceTexel(1.0f - (dir[0] / dir[1] + 1.0f) * 0.5f,
-                                 1.0f - (dir[2] / dir[1] + 1.0f) * 0.5f, DOWN);
+      coords = {DOWN, 1.0f - (dir[0] / dir[1] + 1.0f) * 0.5f,
+                1.0f - (dir[2] / dir[1] + 1.0f) * 0.5f};
     }
   } else if ((std::abs(dir[2]) >= std::abs(dir[0])) &&
              (std::abs(dir[2]) >= std::abs(dir[1]))) {
     if (dir[2] > 0.0f) {
-      outputColor = GetFaceTexel(1.0f - (dir[0] / dir[2] + 1.0f) * 0.5f,
-                                 (dir[1] / dir[2] + 1.0f) * 0.5f, FRONT);
+      coords = {FRONT, 1.0f - (dir[0] / dir[2] + 1.0f) * 0.5f,
+                (dir[1] / dir[2] + 1.0f) * 0.5f};
     } else if (dir[2] < 0.0f) {
-      outputColor = GetFaceTexel((dir[0] / dir[2] + 1.0f) * 0.5f,
-                                 1.0f - (dir[1] / dir[2] + 1.0f) * 0.5f, BACK);
+      coords = {BACK, (dir[0] / dir[2] + 1.0f) * 0.5f,
+                1.0f - (dir[1] / dir[2] + 1.0f) * 0.5f};
     }
   }
+  return coords;
+}
 
-  return outputColor;
+glm::vec3 CubeMap::GetTexel(const glm::vec3& direction, float lod) const {
+  return GetFaceTexel(Project(direction), lod);
 }
 
-const glm::vec3& CubeMap::GetTexturePixel(int x, int y, int face) const {
-  x = std::min(std::max(0, x), (int)(images_[face]->GetWidth() - 1));
-  y = std::min(std::max(0, y), (int)(images_[face]->GetHeight() - 1));
-  return images_[face]->GetPixel(x, y);
+void CubeMap::GetTexels(const glm::vec3* directions,
+                        const float* lods,
+                        size_t count,
+                        glm::vec3* colors) const {
+  const size_t kBatchSize = 64;
+  FaceCoords coords[kBatchSize];
+  for (size_t first = 0; first < count; first += kBatchSize) {
+    size_t size = std::min(kBatchSize, count - first);
+    for (size_t i = 0; i < size; i++) {
+      coords[i] = Project(directions[first + i]);
+      if (coords[i].face < 0) {
+        colors[first + i] = glm::vec3(0.0f);
+      }
+    }
+    for (int face = 0; face < 6; face++) {
+      for (size_t i = 0; i < size; i++) {
+        if (coords[i].face == face) {
+          colors[first + i] = GetFaceTexel(coords[i], lods[first + i]);
+        }
+      }
+    }
+  }
+}
+
+float CubeMap::GetLod(float cone_spread) const {
+  // A face spans 2 units at distance 1, so at its center a level 0 texel
+  // subtends about 2 / width radians.
+  if (!(cone_spread > 0.0f)) {
+    return 0.0f;
+  }
+  float texel_angle = 2.0f / faces_[0][0].width;
+  return std::max(0.0f, std::log2(cone_spread / texel_angle));
+}
+
+size_t CubeMap::GetMemoryUsage() const {
+  size_t bytes = 0;
+  for (int face = 0; face < 6; face++) {
+    for (const Level& level : faces_[face]) {
+      bytes += level.texels.size() * sizeof(uint32_t);
+    }
+  }
+  return bytes;
 }
 }  // namespace GLOO
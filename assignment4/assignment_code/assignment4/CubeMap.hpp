@@ -1,29 +1,61 @@
 #ifndef CUBE_MAP_H_
 #define CUBE_MAP_H_
 
+#include <cstdint>
 #include <string>
-#include <iostream>
+#include <vector>
 
 #include <glm/glm.hpp>
 
-#include "gloo/Image.hpp"
-
 namespace GLOO {
+// Faces are kept as mip chains of 8-bit RGB texels packed into 32 bits,
+// stored in kTileSize x kTileSize tiles so that a bilinear footprint
+// usually touches one tile.
 class CubeMap {
  public:
   // Assumes a directory containing {left,right,up,down,front,back}.png.
   CubeMap(const std::string& directory);
 
-  // Returns color for given directory
-  glm::vec3 GetTexel(const glm::vec3& direction) const;
+  // Returns the color seen along direction. Level 0 is filtered
+  // bilinearly in the full-resolution faces; fractional levels blend the
+  // two nearest mip levels.
+  glm::vec3 GetTexel(const glm::vec3& direction, float lod = 0.0f) const;
+  // GetTexel for count directions at once: all directions are projected
+  // onto their faces first, then the texels are fetched face by face.
+  void GetTexels(const glm::vec3* directions,
+                 const float* lods,
+                 size_t count,
+                 glm::vec3* colors) const;
+  // Level whose texels are about as wide as a cone of the given spread
+  // angle, in radians.
+  float GetLod(float cone_spread) const;
+
+  size_t GetMemoryUsage() const;
 
  private:
+  static const int kTileSize = 8;
+
+  struct Level {
+    int width;
+    int height;
+    int tiles_per_row;
+    std::vector<uint32_t> texels;
+
+    // (x, y) must lie inside the level.
+    uint32_t GetTexel(unsigned x, unsigned y) const;
+  };
+  struct FaceCoords {
+    int face;
+    float x, y;
+  };
+
+  static FaceCoords Project(const glm::vec3& direction);
   // The UV (x, y) coordinates are assumed to be normalized between 0 and 1.
   // The resulting look up is box filtered in the local 2x2 neighborhood.
-  glm::vec3 GetFaceTexel(float x, float y, int face) const;
-  const glm::vec3& GetTexturePixel(int x, int y, int face) const;
+  glm::vec3 GetFaceTexel(float x, float y, int face, int level) const;
+  glm::vec3 GetFaceTexel(const FaceCoords& coords, float lod) const;
 
-  std::unique_ptr<Image> images_[6];
+  std::vector<Level> faces_[6];
 };
 }  // namespace GLOO
 
@@ -1,6 +1,7 @@
 #ifndef HIT_RECORD_H_
 #define HIT_RECORD_H_
 
+#include <cstdint>
 #include <limits>
 #include <ostream>
 
@@ -16,6 +17,8 @@ struct HitRecord {
 
   float time;
   glm::vec3 normal;
+  // Triangle of a mesh that was hit.
+  uint32_t primitive = 0;
 };
 
 inline std::ostream& operator<<(std::ostream& os, const HitRecord& rec) {
@@ -5,31 +5,23 @@
 
 #include <glm/geometric.hpp>
 
-#include "gloo/lights/DirectionalLight.hpp"
-#include "gloo/lights/PointLight.hpp"
-#include "gloo/SceneNode.hpp"
-
 namespace GLOO {
-void Illuminator::GetIllumination(const LightComponent& light_component,
+void Illuminator::GetIllumination(const LightRecord& light,
                                   const glm::vec3& hit_pos,
                                   glm::vec3& dir_to_light,
                                   glm::vec3& intensity,
                                   float& dist_to_light) {
   // Calculation will be done in world space.
 
-  auto light_ptr = light_component.GetLightPtr();
-  if (light_ptr->GetType() == LightType::Directional) {
-    auto directional_light_ptr = static_cast<DirectionalLight*>(light_ptr);
-    dir_to_light = -directional_light_ptr->GetDirection();
-    intensity = directional_light_ptr->GetDiffuseColor();
+  if (light.type == LightType::Directional) {
+    dir_to_light = -light.direction;
+    intensity = light.color;
     dist_to_light = std::numeric_limits<float>::max();
-  } else if (light_ptr->GetType() == LightType::Point) {
-    auto point_light_ptr = static_cast<PointLight*>(light_ptr);
-    glm::vec3 light_pos = light_component.GetNodePtr()->GetTransform().GetPosition();
-    dir_to_light = glm::normalize(light_pos - hit_pos);
-    dist_to_light = glm::distance(light_pos, hit_pos);
-    intensity = point_light_ptr->GetDiffuseColor() / (point_light_ptr->GetAttenuation() * (dist_to_light * dist_to_light));
-  } else {  // TODO: Implement point light.
+  } else if (light.type == LightType::Point) {
+    dir_to_light = glm::normalize(light.position - hit_pos);
+    dist_to_light = glm::distance(light.position, hit_pos);
+    intensity = light.color / (light.attenuation * (dist_to_light * dist_to_light));
+  } else {
     throw std::runtime_error(
         "Unrecognized light type when computing "
         "illumination");
@@ -2,12 +2,14 @@
 #define ILLUMINATOR_H_
 
 #include "gloo/lights/LightBase.hpp"
-#include "gloo/components/LightComponent.hpp"
+
+#include "RenderSnapshot.hpp"
 
 namespace GLOO {
 class Illuminator {
  public:
-  static void GetIllumination(const LightComponent& light_component,
+  // Only point and directional lights illuminate a point this way.
+  static void GetIllumination(const LightRecord& light,
                               const glm::vec3& world_pos,
                               glm::vec3& dir_to_light,
                               glm::vec3& intensity,
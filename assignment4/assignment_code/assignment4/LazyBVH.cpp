@@ -0,0 +1,150 @@
+#include "LazyBVH.hpp"
+
+#include <algorithm>
+
+#include "gloo/utils.hpp"
+
+#include "hittable/Mesh.hpp"
+
+namespace GLOO {
+void LazyBVH::Build(const Mesh& mesh) {
+  mesh_ = &mesh;
+  std::vector<AABB> triangle_bounds(mesh.GetNumTriangles());
+  triangles_.resize(triangle_bounds.size());
+  for (size_t i = 0; i < triangle_bounds.size(); i++) {
+    triangle_bounds[i] = mesh.GetTriangleBounds(i);
+    triangles_[i] = static_cast<uint32_t>(i);
+  }
+
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  std::vector<AABB> bounds;
+  SplitClusters(0, static_cast<uint32_t>(triangles_.size()), triangle_bounds,
+                ranges, bounds);
+  num_clusters_ = ranges.size();
+  clusters_.reset(new Cluster[num_clusters_]);
+  for (size_t i = 0; i < num_clusters_; i++) {
+    clusters_[i].begin = ranges[i].first;
+    clusters_[i].count = ranges[i].second;
+  }
+  top_.BuildFromBounds(bounds);
+}
+
+void LazyBVH::SplitClusters(
+    uint32_t begin,
+    uint32_t end,
+    const std::vector<AABB>& triangle_bounds,
+    std::vector<std::pair<uint32_t, uint32_t>>& ranges,
+    std::vector<AABB>& bounds) {
+  AABB centroid_bounds = AABB::Empty();
+  for (uint32_t i = begin; i < end; i++) {
+    centroid_bounds.Extend(triangle_bounds[triangles_[i]].GetCenter());
+  }
+  glm::vec3 extent = centroid_bounds.mx - centroid_bounds.mn;
+  // Coincident centroids cannot be told apart; keep them in one cluster.
+  if (end - begin <= kClusterSize ||
+      std::max(extent.x, std::max(extent.y, extent.z)) <= 0.0f) {
+    AABB cluster_bounds = AABB::Empty();
+    for (uint32_t i = begin; i < end; i++) {
+      cluster_bounds.UnionWith(triangle_bounds[triangles_[i]]);
+    }
+    ranges.emplace_back(begin, end - begin);
+    bounds.push_back(cluster_bounds);
+    return;
+  }
+
+  int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                 : (extent.y > extent.z ? 1 : 2);
+  uint32_t mid = begin + (end - begin) / 2;
+  std::nth_element(triangles_.begin() + begin, triangles_.begin() + mid,
+                   triangles_.begin() + end, [&](uint32_t a, uint32_t b) {
+                     return triangle_bounds[a].GetCenter()[axis] <
+                            triangle_bounds[b].GetCenter()[axis];
+                   });
+  SplitClusters(begin, mid, triangle_bounds, ranges, bounds);
+  SplitClusters(mid, end, triangle_bounds, ranges, bounds);
+}
+
+const BVH& LazyBVH::GetClusterBVH(uint32_t index) const {
+  Cluster& cluster = clusters_[index];
+  const BVH* bvh = cluster.bvh.load(std::memory_order_acquire);
+  if (bvh == nullptr) {
+    std::call_once(cluster.built, [&]() {
+      // Render threads expand clusters side by side, so each build runs
+      // on the thread that needs it.
+      cluster.bvh_storage = make_unique<BVH>(4, 1);
+      cluster.bvh_storage->Build(
+          *mesh_, std::vector<uint32_t>(
+                      triangles_.begin() + cluster.begin,
+                      triangles_.begin() + cluster.begin + cluster.count));
+      cluster.bvh.store(cluster.bvh_storage.get(), std::memory_order_release);
+    });
+    bvh = cluster.bvh.load(std::memory_order_acquire);
+  }
+  return *bvh;
+}
+
+bool LazyBVH::Intersect(const Ray& ray,
+                        float t_min,
+                        HitRecord& record) const {
+  return top_.Traverse(ray, t_min, record,
+                       [&](uint32_t cluster, HitRecord& rec) {
+                         return GetClusterBVH(cluster).Intersect(ray, t_min,
+                                                                 rec);
+                       });
+}
+
+unsigned LazyBVH::IntersectPacket(const RayPacket& packet,
+                                  float t_min,
+                                  HitRecord* records) const {
+  return top_.TraversePacket(
+      packet, t_min, records,
+      [&](const BVHNode& leaf, unsigned lanes, HitRecord* recs) {
+        RayPacket lane_packet = packet;
+        lane_packet.mask = lanes;
+        unsigned intersected = 0;
+        for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+          intersected |= GetClusterBVH(top_.GetPrimIndex(i))
+                             .IntersectPacket(lane_packet, t_min, recs);
+        }
+        return intersected;
+      },
+      [&](int lane, const BVHNode& leaf, HitRecord& rec) {
+        Ray ray = packet.GetRay(lane);
+        bool intersected = false;
+        for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+          intersected |=
+              GetClusterBVH(top_.GetPrimIndex(i)).Intersect(ray, t_min, rec);
+        }
+        return intersected;
+      });
+}
+
+bool LazyBVH::Occluded(const Ray& ray, float t_min, float t_max) const {
+  return top_.TraverseAny(ray, t_min, t_max, [&](uint32_t cluster) {
+    return GetClusterBVH(cluster).Occluded(ray, t_min, t_max);
+  });
+}
+
+size_t LazyBVH::GetNumBuiltClusters() const {
+  size_t count = 0;
+  for (size_t i = 0; i < num_clusters_; i++) {
+    if (clusters_[i].bvh.load(std::memory_order_acquire) != nullptr) {
+      count++;
+    }
+  }
+  return count;
+}
+
+size_t LazyBVH::GetMemoryUsage() const {
+  size_t usage = top_.GetMemoryUsage() +
+                 triangles_.capacity() * sizeof(uint32_t) +
+                 num_clusters_ * sizeof(Cluster);
+  for (size_t i = 0; i < num_clusters_; i++) {
+    const BVH* bvh = clusters_[i].bvh.load(std::memory_order_acquire);
+    if (bvh != nullptr) {
+      usage += bvh->GetMemoryUsage();
+    }
+  }
+  return usage;
+}
+}  // namespace GLOO
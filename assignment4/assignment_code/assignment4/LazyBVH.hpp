@@ -0,0 +1,76 @@
+#ifndef LAZY_BVH_H_
+#define LAZY_BVH_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "AccelStructure.hpp"
+#include "BVH.hpp"
+
+namespace GLOO {
+// BVH whose lower levels are built on demand. Build only splits the
+// triangles into spatial clusters of up to kClusterSize at their centroid
+// medians and puts a small BVH over the clusters; each cluster gets its
+// own BVH the first time a ray reaches it. Clusters that no ray reaches,
+// such as off-screen or hidden parts of a large scan, are never built,
+// and rendering starts much sooner than after a full build.
+//
+// Expansion is thread-safe: render threads reaching an unbuilt cluster
+// together wait for one of them to build it.
+class LazyBVH : public AccelStructure {
+ public:
+  static const uint32_t kClusterSize = 4096;
+
+  void Build(const Mesh& mesh) override;
+  bool Intersect(const Ray& ray,
+                 float t_min,
+                 HitRecord& record) const override;
+  bool Occluded(const Ray& ray, float t_min, float t_max) const override;
+  unsigned IntersectPacket(const RayPacket& packet,
+                           float t_min,
+                           HitRecord* records) const override;
+  // Grows as clusters are built.
+  size_t GetMemoryUsage() const override;
+
+  size_t GetNumClusters() const {
+    return num_clusters_;
+  }
+  size_t GetNumBuiltClusters() const;
+
+ private:
+  struct Cluster {
+    // Triangles triangles_[begin, begin + count).
+    uint32_t begin = 0;
+    uint32_t count = 0;
+    // Set once bvh_storage is built; read without locking.
+    std::atomic<const BVH*> bvh{nullptr};
+    std::once_flag built;
+    std::unique_ptr<BVH> bvh_storage;
+  };
+
+  // Splits triangles_[begin, end) at the centroid median along its widest
+  // axis until the parts fit in a cluster, appending their ranges and
+  // bounds.
+  void SplitClusters(uint32_t begin,
+                     uint32_t end,
+                     const std::vector<AABB>& triangle_bounds,
+                     std::vector<std::pair<uint32_t, uint32_t>>& ranges,
+                     std::vector<AABB>& bounds);
+  // The BVH of cluster index, building it on first use.
+  const BVH& GetClusterBVH(uint32_t index) const;
+
+  const Mesh* mesh_ = nullptr;
+  std::vector<uint32_t> triangles_;
+  size_t num_clusters_ = 0;
+  // Expanded by the const queries; the array itself is fixed by Build.
+  std::unique_ptr<Cluster[]> clusters_;
+  // Over the cluster bounds; its primitives are cluster indices.
+  BVH top_;
+};
+}  // namespace GLOO
+
+#endif
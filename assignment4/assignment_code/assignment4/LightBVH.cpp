@@ -0,0 +1,88 @@
+#include "LightBVH.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace GLOO {
+float LightBVH::GetInfluenceRadius(const LightRecord& light, float cutoff) {
+  float squared_radius = 0.0f;
+  for (int c = 0; c < 3; c++) {
+    if (light.color[c] <= 0.0f) {
+      continue;
+    }
+    if (light.attenuation[c] <= 0.0f) {
+      return std::numeric_limits<float>::infinity();
+    }
+    squared_radius = std::max(squared_radius,
+                              light.color[c] / (light.attenuation[c] * cutoff));
+  }
+  return std::sqrt(squared_radius);
+}
+
+void LightBVH::Build(const std::vector<LightRecord>& lights, float cutoff) {
+  unbounded_.clear();
+  bounded_.clear();
+  centers_.clear();
+  squared_radii_.clear();
+  std::vector<AABB> bounds;
+  for (size_t i = 0; i < lights.size(); i++) {
+    const LightRecord& light = lights[i];
+    float radius = light.type == LightType::Point && cutoff > 0.0f
+                       ? GetInfluenceRadius(light, cutoff)
+                       : std::numeric_limits<float>::infinity();
+    if (std::isinf(radius)) {
+      unbounded_.push_back(static_cast<uint32_t>(i));
+      continue;
+    }
+    bounded_.push_back(static_cast<uint32_t>(i));
+    centers_.push_back(light.position);
+    squared_radii_.push_back(radius * radius);
+    bounds.push_back(AABB(light.position - glm::vec3(radius),
+                          light.position + glm::vec3(radius)));
+  }
+  if (!bounds.empty()) {
+    bvh_.BuildFromBounds(bounds);
+  }
+}
+
+void LightBVH::Query(const glm::vec3& position,
+                     std::vector<uint32_t>& indices) const {
+  indices = unbounded_;
+  if (bounded_.empty()) {
+    return;
+  }
+  size_t num_unbounded = indices.size();
+  ArrayView<BVHNode> nodes = bvh_.GetNodes();
+  ArrayView<uint32_t> prim_indices = bvh_.GetPrimIndices();
+  uint32_t stack[BVH::kMaxDepth];
+  int stack_size = 0;
+  uint32_t node_index = 0;
+  while (true) {
+    const BVHNode& node = nodes[node_index];
+    bool inside = glm::all(glm::greaterThanEqual(position, node.mn)) &&
+                  glm::all(glm::lessThanEqual(position, node.mx));
+    if (inside && node.IsLeaf()) {
+      for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+        uint32_t light = prim_indices[i];
+        glm::vec3 offset = position - centers_[light];
+        if (glm::dot(offset, offset) <= squared_radii_[light]) {
+          indices.push_back(bounded_[light]);
+        }
+      }
+    } else if (inside) {
+      stack[stack_size++] = node.offset;
+      node_index++;
+      continue;
+    }
+    if (stack_size == 0) {
+      break;
+    }
+    node_index = stack[--stack_size];
+  }
+  // Shading sums the lights in scene order, as without culling.
+  if (indices.size() > num_unbounded) {
+    std::sort(indices.begin(), indices.end());
+  }
+}
+}  // namespace GLOO
@@ -0,0 +1,48 @@
+#ifndef LIGHT_BVH_H_
+#define LIGHT_BVH_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "BVH.hpp"
+#include "RenderSnapshot.hpp"
+
+namespace GLOO {
+// Culls point lights by influence radius: beyond it a light's intensity,
+// color / (attenuation * d^2), is below the cutoff in every channel. The
+// radii's spheres are kept in a BVH, so a point only visits the lights
+// whose sphere contains it.
+class LightBVH {
+ public:
+  // A cutoff of 0 culls nothing.
+  void Build(const std::vector<LightRecord>& lights, float cutoff);
+
+  // Replaces indices with the increasing indices of the lights that may
+  // illuminate position: every light that is not a bounded point light,
+  // and the point lights whose sphere contains position.
+  void Query(const glm::vec3& position, std::vector<uint32_t>& indices) const;
+
+  bool IsCulling() const {
+    return !bounded_.empty();
+  }
+  size_t GetNumBounded() const {
+    return bounded_.size();
+  }
+
+  // Radius within which a point light's intensity is at least cutoff;
+  // infinite if it never drops below it.
+  static float GetInfluenceRadius(const LightRecord& light, float cutoff);
+
+ private:
+  std::vector<uint32_t> unbounded_;
+  std::vector<uint32_t> bounded_;
+  // Of the lights in bounded_.
+  std::vector<glm::vec3> centers_;
+  std::vector<float> squared_radii_;
+  BVH bvh_;
+};
+}  // namespace GLOO
+
+#endif
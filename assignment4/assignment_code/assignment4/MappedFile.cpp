@@ -0,0 +1,54 @@
+#include "MappedFile.hpp"
+
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace GLOO {
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+  if (mapped_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+#endif
+}
+
+bool MappedFile::Open(const std::string& path) {
+#ifndef _WIN32
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    void* address = mmap(nullptr, static_cast<size_t>(info.st_size),
+                         PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address != MAP_FAILED) {
+      close(fd);
+      data_ = static_cast<const char*>(address);
+      size_ = static_cast<size_t>(info.st_size);
+      mapped_ = true;
+      return true;
+    }
+  }
+  close(fd);
+#endif
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return false;
+  }
+  buffer_.resize(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  if (!file.read(buffer_.data(), buffer_.size())) {
+    return false;
+  }
+  data_ = buffer_.data();
+  size_ = buffer_.size();
+  return true;
+}
+}  // namespace GLOO
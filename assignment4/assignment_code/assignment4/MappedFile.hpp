@@ -0,0 +1,37 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <string>
+#include <vector>
+
+namespace GLOO {
+// Read-only contents of a file, memory-mapped where the platform allows
+// and otherwise read into memory.
+class MappedFile {
+ public:
+  MappedFile() : data_(nullptr), size_(0), mapped_(false) {
+  }
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Returns false if the file cannot be opened or read.
+  bool Open(const std::string& path);
+
+  const char* GetData() const {
+    return data_;
+  }
+  size_t GetSize() const {
+    return size_;
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+  bool mapped_;
+  // Used when the file could not be mapped.
+  std::vector<char> buffer_;
+};
+}  // namespace GLOO
+
+#endif
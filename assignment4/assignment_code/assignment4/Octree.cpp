@@ -5,18 +5,55 @@
 #include "gloo/utils.hpp"
 
 #include "hittable/Mesh.hpp"
+#include "TraceStats.hpp"
 
 namespace {
 // If a node contains more than 7 triangles and it
 // hasn't reached the max level yet, split.
 static const int kMaxTerminalCapacity = 7;
 
-bool IntervalIntersect(float* a, float* b) {
-  if (a[0] > b[1]) {
-    return a[0] <= b[1];
-  } else {
-    return b[0] <= a[1];
+// Direct-mapped record of the triangles one ray has already tested.
+// Overlapping leaves share triangles and a ray tends to meet the copies in
+// consecutive leaves, so a small table catches most repeats.
+class Mailbox {
+ public:
+  Mailbox() {
+    std::fill(ids_, ids_ + kSize, kEmpty);
+  }
+
+  // Returns true if id was already tested; records it otherwise.
+  bool TestAndSet(uint32_t id) {
+    uint32_t& slot = ids_[id & (kSize - 1)];
+    if (slot == id) {
+      return true;
+    }
+    slot = id;
+    return false;
   }
+
+ private:
+  static const uint32_t kSize = 32;
+  static const uint32_t kEmpty = 0xffffffff;
+  uint32_t ids_[kSize];
+};
+
+// Mask of the lanes of block holding triangles the ray has not tested yet;
+// marks them as tested.
+unsigned UntestedLanes(const GLOO::TriangleBlock& block, Mailbox& mailbox) {
+  unsigned lanes = 0;
+  for (int lane = 0; lane < GLOO::kTriangleBlockWidth; lane++) {
+    uint32_t id = block.ids[lane];
+    if (id == GLOO::kNoTriangle) {
+      break;
+    }
+    if (mailbox.TestAndSet(id)) {
+      TRACE_STATS_INC(mailbox_skips);
+      continue;
+    }
+    TRACE_STATS_INC(triangle_tests);
+    lanes |= 1u << lane;
+  }
+  return lanes;
 }
 
 // Below are Octree magic based on Revelles' algorithm.
@@ -79,61 +116,17 @@ size_t NextChildIndex(float txm,
 }  // namespace
 
 namespace GLOO {
-bool AABB::Overlap(const AABB& other) const {
-  for (int dim = 0; dim < 3; dim++) {
-    float ia[2] = {mn[dim], mx[dim]};
-    float ib[2] = {other.mn[dim], other.mx[dim]};
-    bool intersect = IntervalIntersect(ia, ib);
-    if (!intersect) {
-      return false;
-    }
-  }
-  return true;
-}
-
-bool AABB::Contain(const AABB& other) const {
-  for (int dim = 0; dim < 3; dim++) {
-    if (mn[dim] > other.mn[dim] || mx[dim] < other.mx[dim]) {
-      return false;
-    }
-  }
-  return true;
-}
-
-void AABB::UnionWith(const AABB& other) {
-  for (int dim = 0; dim < 3; dim++) {
-    mn[dim] = std::min(mn[dim], other.mn[dim]);
-    mx[dim] = std::max(mx[dim], other.mx[dim]);
-  }
-}
-
-AABB AABB::FromTriangle(const Triangle& triangle) {
-  AABB bbox;
-  bbox.mn = bbox.mx = triangle.GetPosition(0);
-  for (int i = 1; i < 3; i++) {
-    for (int dim = 0; dim < 3; dim++) {
-      bbox.mn[dim] = std::min(bbox.mn[dim], triangle.GetPosition(i)[dim]);
-      bbox.mx[dim] = std::max(bbox.mx[dim], triangle.GetPosition(i)[dim]);
-    }
-  }
-  return bbox;
-}
-
-AABB AABB::FromMesh(const Mesh& mesh) {
-  auto& triangles = mesh.GetTriangles();
-  AABB bbox(FromTriangle(triangles[0]));
-  for (size_t i = 1; i < triangles.size(); i++) {
-    bbox.UnionWith(FromTriangle(triangles[i]));
-  }
-  return bbox;
-}
-
 void Octree::BuildNode(OctNode& node,
                        const AABB& bbox,
-                       const std::vector<const Triangle*>& triangles,
+                       const std::vector<uint32_t>& triangles,
+                       const std::vector<AABB>& triangle_bounds,
                        int level) {
   if (triangles.size() <= kMaxTerminalCapacity || level > max_level_) {
-    node.triangles = triangles;
+    node.first_block = static_cast<uint32_t>(blocks_.size());
+    AppendTriangleBlocks(*mesh_, triangles.data(), triangles.size(),
+                         blocks_);
+    node.num_blocks =
+        static_cast<uint32_t>(blocks_.size()) - node.first_block;
     return;
   }
 
@@ -155,54 +148,79 @@ void Octree::BuildNode(OctNode& node,
   child_bbox[6] = AABB(mid[0], mid[1], mn[2], mx[0], mx[1], mid[2]);
   child_bbox[7] = AABB(mid[0], mid[1], mid[2], mx[0], mx[1], mx[2]);
 
+  // The children are built one after another, so they can share a list.
+  std::vector<uint32_t> child_triangles;
+  child_triangles.reserve(triangles.size());
   for (size_t i = 0; i < 8; i++) {
-    std::vector<const Triangle*> child_triangles;
+    child_triangles.clear();
     for (size_t vi = 0; vi < triangles.size(); vi++) {
-      const Triangle* triangle = triangles[vi];
-      AABB triangle_bbox = AABB::FromTriangle(*triangle);
+      uint32_t triangle = triangles[vi];
+      const AABB& triangle_bbox = triangle_bounds[triangle];
       if (child_bbox[i].Contain(triangle_bbox) ||
           child_bbox[i].Overlap(triangle_bbox)) {
         child_triangles.push_back(triangle);
       }
     }
-    BuildNode(*node.child[i], child_bbox[i], child_triangles, level + 1);
+    BuildNode(*node.child[i], child_bbox[i], child_triangles, triangle_bounds,
+              level + 1);
   }
 }
 
 void Octree::Build(const Mesh& mesh) {
-  auto& triangles = mesh.GetTriangles();
-  bbox_ = AABB::FromMesh(mesh);
+  mesh_ = &mesh;
+  bbox_ = mesh.GetLocalBounds();
 
-  std::vector<const Triangle*> triangle_ptrs;
-  for (size_t i = 0; i < triangles.size(); i++)
-    triangle_ptrs.push_back(&triangles[i]);
+  std::vector<uint32_t> triangles(mesh.GetNumTriangles());
+  std::vector<AABB> triangle_bounds(triangles.size());
+  for (size_t i = 0; i < triangles.size(); i++) {
+    triangles[i] = static_cast<uint32_t>(i);
+    triangle_bounds[i] = mesh.GetTriangleBounds(i);
+  }
+  blocks_.clear();
   root_ = make_unique<OctNode>();
-  BuildNode(*root_, bbox_, triangle_ptrs, 0);
+  BuildNode(*root_, bbox_, triangles, triangle_bounds, 0);
+  blocks_.shrink_to_fit();
 }
 
-bool Octree::IntersectSubtree(uint8_t aa,
-                              const OctNode& node,
-                              float tx0,
-                              float ty0,
-                              float tz0,
-                              float tx1,
-                              float ty1,
-                              float tz1,
-                              const Ray& ray,
-                              float t_min,
-                              HitRecord& record) {
-  bool intersected = false;
+size_t Octree::GetMemoryUsage() const {
+  return root_ == nullptr ? 0
+                         : GetSubtreeMemoryUsage(*root_) +
+                               blocks_.capacity() * sizeof(TriangleBlock);
+}
+
+size_t Octree::GetSubtreeMemoryUsage(const OctNode& node) const {
+  size_t bytes = sizeof(OctNode);
+  if (!node.IsTerminal()) {
+    for (size_t i = 0; i < 8; i++) {
+      bytes += GetSubtreeMemoryUsage(*node.child[i]);
+    }
+  }
+  return bytes;
+}
+
+template <typename VisitLeaf>
+bool Octree::VisitSubtree(uint8_t aa,
+                          const OctNode& node,
+                          float tx0,
+                          float ty0,
+                          float tz0,
+                          float tx1,
+                          float ty1,
+                          float tz1,
+                          const float& t_limit,
+                          VisitLeaf& visit_leaf) const {
   if (tx1 < 0 || ty1 < 0 || tz1 < 0) {
-    return intersected;
+    return false;
   }
+  // Cells are visited in ray order, so once the closest hit lies before
+  // this cell's entry, neither it nor any later cell can do better.
+  if (std::max(std::max(tx0, ty0), tz0) > t_limit) {
+    return false;
+  }
+  TRACE_STATS_INC(node_visits);
 
   if (node.IsTerminal()) {
-    // Brute force over things.
-    for (auto& t : node.triangles) {
-      bool result = t->Intersect(ray, t_min, record);
-      intersected |= result;
-    }
-    return intersected;
+    return visit_leaf(node);
   }
 
   float txm = 0.5f * (tx0 + tx1);
@@ -212,52 +230,71 @@ bool Octree::IntersectSubtree(uint8_t aa,
   do {
     switch (cur) {
       case 0: {
-        intersected |= IntersectSubtree(aa, *node.child[aa], tx0, ty0, tz0, txm,
-                                        tym, tzm, ray, t_min, record);
+        if (VisitSubtree(aa, *node.child[aa], tx0, ty0, tz0, txm, tym, tzm,
+                         t_limit, visit_leaf)) {
+          return true;
+        }
         cur = NextChildIndex(txm, 4, tym, 2, tzm, 1);
       } break;
       case 1: {
-        intersected |= IntersectSubtree(aa, *node.child[1 ^ aa], tx0, ty0, tzm,
-                                        txm, tym, tz1, ray, t_min, record);
+        if (VisitSubtree(aa, *node.child[1 ^ aa], tx0, ty0, tzm, txm, tym, tz1,
+                         t_limit, visit_leaf)) {
+          return true;
+        }
         cur = NextChildIndex(txm, 5, tym, 3, tz1, 8);
       } break;
       case 2: {
-        intersected |= IntersectSubtree(aa, *node.child[2 ^ aa], tx0, tym, tz0,
-                                        txm, ty1, tzm, ray, t_min, record);
+        if (VisitSubtree(aa, *node.child[2 ^ aa], tx0, tym, tz0, txm, ty1, tzm,
+                         t_limit, visit_leaf)) {
+          return true;
+        }
         cur = NextChildIndex(txm, 6, ty1, 8, tzm, 3);
       } break;
       case 3: {
-        intersected |= IntersectSubtree(aa, *node.child[3 ^ aa], tx0, tym, tzm,
-                                        txm, ty1, tz1, ray, t_min, record);
+        if (VisitSubtree(aa, *node.child[3 ^ aa], tx0, tym, tzm, txm, ty1, tz1,
+                         t_limit, visit_leaf)) {
+          return true;
+        }
         cur = NextChildIndex(txm, 7, ty1, 8, tz1, 8);
       } break;
       case 4: {
-        intersected |= IntersectSubtree(aa, *node.child[4 ^ aa], txm, ty0, tz0,
-                                        tx1, tym, tzm, ray, t_min, record);
+        if (VisitSubtree(aa, *node.child[4 ^ aa], txm, ty0, tz0, tx1, tym, tzm,
+                         t_limit, visit_leaf)) {
+          return true;
+        }
         cur = NextChildIndex(tx1, 8, tym, 6, tzm, 5);
       } break;
       case 5: {
-        intersected |= IntersectSubtree(aa, *node.child[5 ^ aa], txm, ty0, tzm,
-                                        tx1, tym, tz1, ray, t_min, record);
+        if (VisitSubtree(aa, *node.child[5 ^ aa], txm, ty0, tzm, tx1, tym, tz1,
+                         t_limit, visit_leaf)) {
+          return true;
+        }
         cur = NextChildIndex(tx1, 8, tym, 7, tz1, 8);
       } break;
       case 6: {
-        intersected |= IntersectSubtree(aa, *node.child[6 ^ aa], txm, tym, tz0,
-                                        tx1, ty1, tzm, ray, t_min, record);
+        if (VisitSubtree(aa, *node.child[6 ^ aa], txm, tym, tz0, tx1, ty1, tzm,
+                         t_limit, visit_leaf)) {
+          return true;
+        }
         cur = NextChildIndex(tx1, 8, ty1, 8, tzm, 7);
       } break;
       case 7: {
-        intersected |= IntersectSubtree(aa, *node.child[7 ^ aa], txm, tym, tzm,
-                                        tx1, ty1, tz1, ray, t_min, record);
+        if (VisitSubtree(aa, *node.child[7 ^ aa], txm, tym, tzm, tx1, ty1, tz1,
+                         t_limit, visit_leaf)) {
+          return true;
+        }
         cur = 8;
       } break;
     }
   } while (cur < 8);
 
-  return intersected;
+  return false;
 }
 
-bool Octree::Intersect(const Ray& ray, float t_min, HitRecord& record) {
+template <typename VisitLeaf>
+bool Octree::Visit(const Ray& ray,
+                   const float& t_limit,
+                   VisitLeaf& visit_leaf) const {
   glm::vec3 ray_dir = ray.GetDirection();
   // TODO: does ray_dir need to be unit?
   glm::vec3 ray_origin = ray.GetOrigin();
@@ -272,8 +309,8 @@ bool Octree::Intersect(const Ray& ray, float t_min, HitRecord& record) {
     }
 
     if (ray_dir[dim] == 0) {
-      ray_dir[dim] = 10e-9;
-    }
+      ray_dir[dim] = 10e-9;
+    }
   }
 
   float divx = 1 / ray_dir[0];
@@ -288,10 +325,59 @@ bool Octree::Intersect(const Ray& ray, float t_min, HitRecord& record) {
   float tz1 = (bbox_.mx[2] - ray_origin[2]) * divz;
 
   if (std::max(std::max(tx0, ty0), tz0) <= std::min(std::min(tx1, ty1), tz1)) {
-    return IntersectSubtree(aa, *root_, tx0, ty0, tz0, tx1, ty1, tz1, ray,
-                            t_min, record);
+    return VisitSubtree(aa, *root_, tx0, ty0, tz0, tx1, ty1, tz1, t_limit,
+                        visit_leaf);
   } else {
     return false;
   }
 }
+
+bool Octree::Intersect(const Ray& ray,
+                       float t_min,
+                       HitRecord& record) const {
+  const glm::vec3& origin = ray.GetOrigin();
+  const glm::vec3& direction = ray.GetDirection();
+  bool intersected = false;
+  Mailbox mailbox;
+  auto visit_leaf = [&](const OctNode& leaf) {
+    for (uint32_t b = leaf.first_block; b < leaf.first_block + leaf.num_blocks;
+         b++) {
+      const TriangleBlock& block = blocks_[b];
+      unsigned lanes = UntestedLanes(block, mailbox);
+      if (lanes == 0) {
+        continue;
+      }
+      float t, beta, gamma;
+      int lane = IntersectTriangleBlockClosest(
+          block, origin, direction, t_min, record.time, lanes, t, beta, gamma);
+      if (lane >= 0) {
+        mesh_->RecordHit(block.ids[lane], t, beta, gamma, record);
+        intersected = true;
+      }
+    }
+    return false;
+  };
+  Visit(ray, record.time, visit_leaf);
+  return intersected;
+}
+
+bool Octree::Occluded(const Ray& ray, float t_min, float t_max) const {
+  const glm::vec3& origin = ray.GetOrigin();
+  const glm::vec3& direction = ray.GetDirection();
+  Mailbox mailbox;
+  auto visit_leaf = [&](const OctNode& leaf) {
+    for (uint32_t b = leaf.first_block; b < leaf.first_block + leaf.num_blocks;
+         b++) {
+      const TriangleBlock& block = blocks_[b];
+      unsigned lanes = UntestedLanes(block, mailbox);
+      if (lanes != 0 &&
+          IntersectTriangleBlock(block, origin, direction, t_min, t_max, true,
+                                 lanes, nullptr, nullptr, nullptr)) {
+        return true;
+      }
+    }
+    return false;
+  };
+  return Visit(ray, t_max, visit_leaf);
+}
 }  // namespace GLOO
@@ -1,41 +1,31 @@
 #ifndef OCTREE_H_
 #define OCTREE_H_
 
+#include <cstdint>
 #include <memory>
+#include <vector>
 
 #include <glm/glm.hpp>
 
+#include "AABB.hpp"
+#include "AccelStructure.hpp"
 #include "HitRecord.hpp"
-#include "hittable/Triangle.hpp"
+#include "TriangleBlock.hpp"
 
 namespace GLOO {
 // Forward declarations.
 class Mesh;
 
-struct AABB {
-  AABB() {
-  }
-  AABB(const glm::vec3& _mn, const glm::vec3& _mx) : mn(_mn), mx(_mx) {
-  }
-  AABB(float mnx, float mny, float mnz, float mxx, float mxy, float mxz)
-      : mn(glm::vec3(mnx, mny, mnz)), mx(glm::vec3(mxx, mxy, mxz)) {
-  }
-  static AABB FromTriangle(const Triangle& triangle);
-  static AABB FromMesh(const Mesh& mesh);
-
-  void UnionWith(const AABB& other);
-  bool Overlap(const AABB& other) const;
-  bool Contain(const AABB& other) const;
-
-  glm::vec3 mn, mx;
-};
-
-class Octree {
+class Octree : public AccelStructure {
  public:
   Octree(int max_level = 8) : max_level_(max_level) {
   }
-  void Build(const Mesh& mesh);
-  bool Intersect(const Ray& ray, float t_min, HitRecord& record);
+  void Build(const Mesh& mesh) override;
+  bool Intersect(const Ray& ray,
+                 float t_min,
+                 HitRecord& record) const override;
+  bool Occluded(const Ray& ray, float t_min, float t_max) const override;
+  size_t GetMemoryUsage() const override;
 
  private:
   struct OctNode {
@@ -44,29 +34,47 @@ class Octree {
     }
 
     std::unique_ptr<OctNode> child[8];
-    std::vector<const Triangle*> triangles;
+    // Triangles of a terminal node: blocks_[first_block, first_block +
+    // num_blocks).
+    uint32_t first_block = 0;
+    uint32_t num_blocks = 0;
   };
 
+  // triangle_bounds holds the bounds of every mesh triangle, computed once
+  // per build.
   void BuildNode(OctNode& node,
                  const AABB& bbox,
-                 const std::vector<const Triangle*>& triangles,
+                 const std::vector<uint32_t>& triangles,
+                 const std::vector<AABB>& triangle_bounds,
                  int level);
 
-  bool IntersectSubtree(uint8_t aa,
-                        const OctNode& node,
-                        float tx0,
-                        float ty0,
-                        float tz0,
-                        float tx1,
-                        float ty1,
-                        float tz1,
-                        const Ray& r,
-                        float t_min,
-                        HitRecord& record);
+  // Walks the leaves the ray passes through in ray order, calling
+  // visit_leaf(leaf) on each; stops early once visit_leaf returns true.
+  // Cells that the ray enters after t_limit are skipped; t_limit may
+  // shrink while the walk is in progress.
+  template <typename VisitLeaf>
+  bool Visit(const Ray& ray,
+             const float& t_limit,
+             VisitLeaf& visit_leaf) const;
+  template <typename VisitLeaf>
+  bool VisitSubtree(uint8_t aa,
+                    const OctNode& node,
+                    float tx0,
+                    float ty0,
+                    float tz0,
+                    float tx1,
+                    float ty1,
+                    float tz1,
+                    const float& t_limit,
+                    VisitLeaf& visit_leaf) const;
+  size_t GetSubtreeMemoryUsage(const OctNode& node) const;
 
   int max_level_;
   AABB bbox_;
   std::unique_ptr<OctNode> root_;
+  const Mesh* mesh_ = nullptr;
+  // Terminal node triangles, packed for the SIMD kernel.
+  std::vector<TriangleBlock> blocks_;
 };
 }  // namespace GLOO
 
@@ -0,0 +1,341 @@
+#include "PNGStreamWriter.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+const size_t kWindowSize = 32768;
+const int kHashBits = 15;
+const int kMaxChainLength = 32;
+const int kMinMatch = 3;
+const int kMaxMatch = 258;
+
+const int kLengthBases[29] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                              15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                              67, 83, 99, 115, 131, 163, 195, 227, 258};
+const int kLengthExtraBits[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                  1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                  4, 4, 4, 4, 5, 5, 5, 5, 0};
+const int kDistanceBases[30] = {
+    1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,
+    97,  129, 193, 257, 385, 513,  769,  1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577};
+const int kDistanceExtraBits[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                    4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                    9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size) {
+  static uint32_t table[256];
+  static bool initialized = false;
+  if (!initialized) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+    initialized = true;
+  }
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void PutUint32BigEndian(uint8_t* out, uint32_t value) {
+  out[0] = uint8_t(value >> 24);
+  out[1] = uint8_t(value >> 16);
+  out[2] = uint8_t(value >> 8);
+  out[3] = uint8_t(value);
+}
+
+uint8_t Paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = std::abs(p - a);
+  int pb = std::abs(p - b);
+  int pc = std::abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return uint8_t(a);
+  }
+  return uint8_t(pb <= pc ? b : c);
+}
+
+uint32_t Hash3(const uint8_t* p) {
+  uint32_t v = uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16);
+  return (v * 2654435761u) >> (32 - kHashBits);
+}
+}  // namespace
+
+namespace GLOO {
+PNGStreamWriter::PNGStreamWriter(const std::string& filename,
+                                 size_t width,
+                                 size_t height)
+    : filename_(filename),
+      temp_filename_(filename + ".tmp.png"),
+      width_(width),
+      height_(height),
+      previous_row_(width * 3, 0) {
+  file_ = fopen(temp_filename_.c_str(), "wb");
+  if (file_ == nullptr) {
+    throw std::runtime_error("Cannot write " + temp_filename_ + "!");
+  }
+  static const uint8_t kSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n',
+                                        0x1a, '\n'};
+  WriteBytes(kSignature, sizeof(kSignature));
+  uint8_t header[13];
+  PutUint32BigEndian(header, uint32_t(width));
+  PutUint32BigEndian(header + 4, uint32_t(height));
+  header[8] = 8;   // Bit depth.
+  header[9] = 2;   // RGB.
+  header[10] = 0;  // Deflate.
+  header[11] = 0;  // Adaptive filtering.
+  header[12] = 0;  // Not interlaced.
+  WriteChunk("IHDR", header, sizeof(header));
+
+  // zlib header: deflate with a 32 KB window, no preset dictionary.
+  compressed_.push_back(0x78);
+  compressed_.push_back(0x01);
+  hash_heads_.assign(size_t(1) << kHashBits, -1);
+}
+
+PNGStreamWriter::~PNGStreamWriter() {
+  if (file_ != nullptr) {
+    fclose(file_);
+    std::remove(temp_filename_.c_str());
+  }
+}
+
+void PNGStreamWriter::WriteRows(const uint8_t* rows, size_t num_rows) {
+  if (rows_written_ + num_rows > height_) {
+    throw std::runtime_error("Too many rows for " + filename_ + "!");
+  }
+  // Each row gets the filter with the smallest sum of absolute signed
+  // residuals, the usual heuristic.
+  size_t stride = width_ * 3;
+  filtered_.resize(num_rows * (stride + 1));
+  std::vector<uint8_t> candidate(stride);
+  for (size_t r = 0; r < num_rows; r++) {
+    const uint8_t* row = rows + r * stride;
+    const uint8_t* up = previous_row_.data();
+    uint8_t* out = &filtered_[r * (stride + 1)];
+    long best_cost = -1;
+    for (int filter = 0; filter < 5; filter++) {
+      long cost = 0;
+      for (size_t i = 0; i < stride; i++) {
+        int left = i >= 3 ? row[i - 3] : 0;
+        int up_left = i >= 3 ? up[i - 3] : 0;
+        int predicted = 0;
+        switch (filter) {
+          case 1:
+            predicted = left;
+            break;
+          case 2:
+            predicted = up[i];
+            break;
+          case 3:
+            predicted = (left + up[i]) / 2;
+            break;
+          case 4:
+            predicted = Paeth(left, up[i], up_left);
+            break;
+        }
+        candidate[i] = uint8_t(row[i] - predicted);
+        cost += std::abs(int(int8_t(candidate[i])));
+      }
+      if (best_cost < 0 || cost < best_cost) {
+        best_cost = cost;
+        out[0] = uint8_t(filter);
+        std::copy(candidate.begin(), candidate.end(), out + 1);
+      }
+    }
+    std::copy(row, row + stride, previous_row_.begin());
+  }
+  Deflate(filtered_.data(), filtered_.size());
+  rows_written_ += num_rows;
+
+  WriteChunk("IDAT", compressed_.data(), compressed_.size());
+  compressed_.clear();
+}
+
+void PNGStreamWriter::Close() {
+  if (rows_written_ != height_) {
+    throw std::runtime_error("Missing rows in " + filename_ + "!");
+  }
+  FinishDeflate();
+  WriteChunk("IDAT", compressed_.data(), compressed_.size());
+  compressed_.clear();
+  WriteChunk("IEND", nullptr, 0);
+  bool failed = ferror(file_) != 0;
+  failed |= fclose(file_) != 0;
+  file_ = nullptr;
+  if (failed ||
+      std::rename(temp_filename_.c_str(), filename_.c_str()) != 0) {
+    std::remove(temp_filename_.c_str());
+    throw std::runtime_error("Cannot write " + filename_ + "!");
+  }
+}
+
+void PNGStreamWriter::Deflate(const uint8_t* data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    adler_a_ = (adler_a_ + data[i]) % 65521;
+    adler_b_ = (adler_b_ + adler_a_) % 65521;
+  }
+
+  // Matches are searched in the history followed by the new data;
+  // positions index that concatenation.
+  size_t history_size = history_.size();
+  std::vector<uint8_t> input(history_);
+  input.insert(input.end(), data, data + size);
+  hash_chain_.assign(input.size(), -1);
+  std::fill(hash_heads_.begin(), hash_heads_.end(), -1);
+  auto insert = [&](size_t pos) {
+    uint32_t h = Hash3(&input[pos]);
+    hash_chain_[pos] = hash_heads_[h];
+    hash_heads_[h] = int32_t(pos);
+  };
+  for (size_t pos = 0; pos + kMinMatch <= history_size; pos++) {
+    insert(pos);
+  }
+
+  // Block header: not final, fixed Huffman codes.
+  PutBits(0, 1);
+  PutBits(1, 2);
+  size_t pos = history_size;
+  while (pos < input.size()) {
+    int best_length = 0;
+    int best_distance = 0;
+    if (pos + kMinMatch <= input.size()) {
+      int max_length = int(std::min<size_t>(kMaxMatch, input.size() - pos));
+      int32_t candidate = hash_heads_[Hash3(&input[pos])];
+      for (int chain = 0; chain < kMaxChainLength && candidate >= 0 &&
+                          pos - candidate <= kWindowSize;
+           chain++) {
+        const uint8_t* a = &input[candidate];
+        const uint8_t* b = &input[pos];
+        if (a[best_length] == b[best_length]) {
+          int length = 0;
+          while (length < max_length && a[length] == b[length]) {
+            length++;
+          }
+          if (length > best_length) {
+            best_length = length;
+            best_distance = int(pos - candidate);
+            if (length == max_length) {
+              break;
+            }
+          }
+        }
+        candidate = hash_chain_[candidate];
+      }
+    }
+
+    if (best_length >= kMinMatch) {
+      PutMatch(best_length, best_distance);
+      for (int k = 0; k < best_length; k++, pos++) {
+        if (pos + kMinMatch <= input.size()) {
+          insert(pos);
+        }
+      }
+    } else {
+      PutLiteral(input[pos]);
+      if (pos + kMinMatch <= input.size()) {
+        insert(pos);
+      }
+      pos++;
+    }
+  }
+  // End of block.
+  PutCode(0, 7);
+
+  size_t keep = std::min(kWindowSize, input.size());
+  history_.assign(input.end() - keep, input.end());
+}
+
+void PNGStreamWriter::FinishDeflate() {
+  // An empty final block, then the Adler-32 checksum of all input.
+  PutBits(1, 1);
+  PutBits(1, 2);
+  PutCode(0, 7);
+  if (bit_count_ > 0) {
+    PutBits(0, 8 - bit_count_);
+  }
+  uint8_t checksum[4];
+  PutUint32BigEndian(checksum, (adler_b_ << 16) | adler_a_);
+  compressed_.insert(compressed_.end(), checksum, checksum + 4);
+}
+
+void PNGStreamWriter::PutBits(uint32_t bits, int count) {
+  bit_buffer_ |= bits << bit_count_;
+  bit_count_ += count;
+  while (bit_count_ >= 8) {
+    compressed_.push_back(uint8_t(bit_buffer_));
+    bit_buffer_ >>= 8;
+    bit_count_ -= 8;
+  }
+}
+
+void PNGStreamWriter::PutCode(uint32_t code, int length) {
+  uint32_t reversed = 0;
+  for (int i = 0; i < length; i++) {
+    reversed = (reversed << 1) | ((code >> i) & 1);
+  }
+  PutBits(reversed, length);
+}
+
+void PNGStreamWriter::PutLiteral(uint8_t literal) {
+  if (literal < 144) {
+    PutCode(0x30 + literal, 8);
+  } else {
+    PutCode(0x190 + literal - 144, 9);
+  }
+}
+
+void PNGStreamWriter::PutMatch(int length, int distance) {
+  int code = 0;
+  while (code < 28 && kLengthBases[code + 1] <= length) {
+    code++;
+  }
+  int symbol = 257 + code;
+  if (symbol < 280) {
+    PutCode(symbol - 256, 7);
+  } else {
+    PutCode(0xc0 + symbol - 280, 8);
+  }
+  PutBits(length - kLengthBases[code], kLengthExtraBits[code]);
+
+  int distance_code = 0;
+  while (distance_code < 29 && kDistanceBases[distance_code + 1] <= distance) {
+    distance_code++;
+  }
+  PutCode(distance_code, 5);
+  PutBits(distance - kDistanceBases[distance_code],
+          kDistanceExtraBits[distance_code]);
+}
+
+void PNGStreamWriter::WriteChunk(const char* type,
+                                 const uint8_t* data,
+                                 size_t size) {
+  uint8_t length[4];
+  PutUint32BigEndian(length, uint32_t(size));
+  WriteBytes(length, 4);
+  WriteBytes(type, 4);
+  if (size > 0) {
+    WriteBytes(data, size);
+  }
+  uint32_t crc = Crc32(0, reinterpret_cast<const uint8_t*>(type), 4);
+  crc = Crc32(crc, data, size);
+  uint8_t crc_bytes[4];
+  PutUint32BigEndian(crc_bytes, crc);
+  WriteBytes(crc_bytes, 4);
+}
+
+void PNGStreamWriter::WriteBytes(const void* data, size_t size) {
+  if (fwrite(data, 1, size, file_) != size) {
+    throw std::runtime_error("Cannot write " + temp_filename_ + "!");
+  }
+}
+}  // namespace GLOO
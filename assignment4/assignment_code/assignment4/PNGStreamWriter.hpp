@@ -0,0 +1,62 @@
+#ifndef PNG_STREAM_WRITER_H_
+#define PNG_STREAM_WRITER_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace GLOO {
+// Writes an 8-bit RGB PNG a few rows at a time. Each batch of rows is
+// filtered, compressed and written as soon as it arrives, so memory use
+// is bounded by the batch size rather than by the image size. The file
+// appears under its name only once Close succeeds.
+class PNGStreamWriter {
+ public:
+  PNGStreamWriter(const std::string& filename, size_t width, size_t height);
+  ~PNGStreamWriter();
+  PNGStreamWriter(const PNGStreamWriter&) = delete;
+  PNGStreamWriter& operator=(const PNGStreamWriter&) = delete;
+
+  // Appends num_rows rows of width * 3 bytes each, top row first.
+  void WriteRows(const uint8_t* rows, size_t num_rows);
+  // Finishes the file once every row has been written.
+  void Close();
+
+ private:
+  // Appends data to the zlib stream as one fixed-Huffman deflate block,
+  // with matches reaching back into the previous 32 KB of input.
+  void Deflate(const uint8_t* data, size_t size);
+  void FinishDeflate();
+  void PutBits(uint32_t bits, int count);
+  // Writes a Huffman code, which deflate stores most significant bit
+  // first.
+  void PutCode(uint32_t code, int length);
+  void PutLiteral(uint8_t literal);
+  void PutMatch(int length, int distance);
+  void WriteChunk(const char* type, const uint8_t* data, size_t size);
+  void WriteBytes(const void* data, size_t size);
+
+  std::string filename_;
+  std::string temp_filename_;
+  FILE* file_ = nullptr;
+  size_t width_;
+  size_t height_;
+  size_t rows_written_ = 0;
+
+  std::vector<uint8_t> previous_row_;
+  std::vector<uint8_t> filtered_;
+  // The last input bytes, which later matches may refer to.
+  std::vector<uint8_t> history_;
+  std::vector<int32_t> hash_heads_;
+  std::vector<int32_t> hash_chain_;
+  uint32_t adler_a_ = 1;
+  uint32_t adler_b_ = 0;
+  // Compressed bytes not yet written as an IDAT chunk.
+  std::vector<uint8_t> compressed_;
+  uint32_t bit_buffer_ = 0;
+  int bit_count_ = 0;
+};
+}  // namespace GLOO
+
+#endif
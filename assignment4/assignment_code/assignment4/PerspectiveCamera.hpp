@@ -18,17 +18,24 @@ class PerspectiveCamera {
     up_ = glm::normalize(spec.up);
     fov_radian_ = ToRadian(spec.fov);
     horizontal_ = glm::normalize(glm::cross(direction_, up_));
+    // Distance to the image plane, which spans [-1, 1] in both directions.
+    float d = 1.0f / tanf(fov_radian_ / 2.0f);
+    forward_ = d * direction_;
   }
 
-  Ray GenerateRay(const glm::vec2& point) {
-    float d = 1.0f / tanf(fov_radian_ / 2.0f);
-    glm::vec3 new_dir =
-        d * direction_ + point[0] * horizontal_ + point[1] * up_;
+  Ray GenerateRay(const glm::vec2& point) const {
+    glm::vec3 new_dir = forward_ + point[0] * horizontal_ + point[1] * up_;
     new_dir = glm::normalize(new_dir);
 
     return Ray(center_, new_dir);
   }
 
+  // Angle between the rays through neighbouring pixels at the image
+  // center, for an image height pixels high.
+  float GetPixelSpread(int height) const {
+    return 2.0f * tanf(fov_radian_ / 2.0f) / height;
+  }
+
   float GetTMin() const {
     return 0.0f;
   }
@@ -39,6 +46,7 @@ class PerspectiveCamera {
   glm::vec3 up_;
   float fov_radian_;
   glm::vec3 horizontal_;
+  glm::vec3 forward_;
 };
 }  // namespace GLOO
 
@@ -0,0 +1,58 @@
+#ifndef RANDOM_H_
+#define RANDOM_H_
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace GLOO {
+// Counter-based random numbers: a value depends only on its inputs, so a
+// pixel gets the same samples whichever thread renders it, in any order.
+
+// PCG output permutation, a cheap well-mixing hash of 32 bits.
+inline uint32_t HashUint(uint32_t v) {
+  uint32_t state = v * 747796405u + 2891336453u;
+  uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+// Maps 32 random bits to a uniform value in [0, 1).
+inline float ToUnitFloat(uint32_t bits) {
+  return static_cast<float>(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// Uniform value in [0, 1) for dimension of sample of pixel (x, y).
+inline float SampleRandom(uint32_t x,
+                          uint32_t y,
+                          uint32_t sample,
+                          uint32_t dimension) {
+  return ToUnitFloat(
+      HashUint(x + HashUint(y + HashUint(sample + HashUint(dimension)))));
+}
+
+// Stratum of sample index among 4^levels strata of the unit square,
+// returned as its (column, row) in a 2^levels grid. Indices are taken in
+// bit-reversed order and decoded as a Morton code, so the first 4^k
+// samples of every group of 4^levels fall in distinct cells of the 2^k
+// grid. XOR-ing in scramble shuffles the strata without losing that.
+inline glm::uvec2 ProgressiveStratum(uint32_t index,
+                                     uint32_t levels,
+                                     uint32_t scramble) {
+  uint32_t bits = 2 * levels;
+  uint32_t reversed = 0;
+  for (uint32_t i = 0; i < bits; i++) {
+    reversed |= ((index >> i) & 1u) << (bits - 1 - i);
+  }
+  if (bits > 0) {
+    reversed ^= scramble & ((1u << bits) - 1);
+  }
+  glm::uvec2 stratum(0);
+  for (uint32_t i = 0; i < levels; i++) {
+    stratum.x |= ((reversed >> (2 * i)) & 1u) << i;
+    stratum.y |= ((reversed >> (2 * i + 1)) & 1u) << i;
+  }
+  return stratum;
+}
+}  // namespace GLOO
+
+#endif
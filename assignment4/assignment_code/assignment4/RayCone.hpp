@@ -0,0 +1,26 @@
+#ifndef RAY_CONE_H_
+#define RAY_CONE_H_
+
+namespace GLOO {
+// Footprint of a ray traced as a cone: its width where the ray starts and
+// the angle by which it widens (the ray cones of Akenine-Moller et al.).
+// Reflections off curved surfaces widen it, so what they see of the cube
+// map is filtered more.
+struct RayCone {
+  float width = 0.0f;
+  float spread = 0.0f;
+
+  // Moves the cone's start distance t along its ray.
+  void Propagate(float t) {
+    width += spread * t;
+  }
+  // Reflection off a surface whose normal turns by curvature radians per
+  // unit length; the mirror direction turns twice as fast across the
+  // footprint.
+  void Reflect(float curvature) {
+    spread += 2.0f * curvature * width;
+  }
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef RAY_PACKET_H_
+#define RAY_PACKET_H_
+
+#include <glm/glm.hpp>
+
+#include "Ray.hpp"
+
+namespace GLOO {
+// Primary rays are traced together for kPacketWidth x kPacketWidth pixels.
+const int kPacketWidth = 2;
+const int kPacketSize = kPacketWidth * kPacketWidth;
+
+// A group of rays that traverse the scene together. Only lanes set in
+// mask hold rays; the others are left uninitialized.
+struct RayPacket {
+  Ray GetRay(int lane) const {
+    return Ray(origins[lane], directions[lane]);
+  }
+  void SetRay(int lane, const Ray& ray) {
+    origins[lane] = ray.GetOrigin();
+    directions[lane] = ray.GetDirection();
+  }
+  // Transforms every active ray, as Ray::ApplyTransform.
+  void ApplyTransform(const glm::mat4& transform) {
+    for (int lane = 0; lane < kPacketSize; lane++) {
+      if (mask & (1u << lane)) {
+        Ray ray = GetRay(lane);
+        ray.ApplyTransform(transform);
+        SetRay(lane, ray);
+      }
+    }
+  }
+
+  glm::vec3 origins[kPacketSize];
+  glm::vec3 directions[kPacketSize];
+  unsigned mask = 0;
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,60 @@
+#include "RenderSnapshot.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+#include "gloo/Transform.hpp"
+#include "gloo/components/LightComponent.hpp"
+#include "gloo/components/MaterialComponent.hpp"
+#include "gloo/lights/DirectionalLight.hpp"
+#include "gloo/lights/PointLight.hpp"
+
+#include "TracingComponent.hpp"
+
+namespace GLOO {
+void RenderSnapshot::Compile(const Scene& scene) {
+  auto& root = scene.GetRootNode();
+
+  objects_.clear();
+  for (auto component : root.GetComponentPtrsInChildren<TracingComponent>()) {
+    SceneNode* node = component->GetNodePtr();
+    ObjectRecord object;
+    object.hittable = &component->GetHittable();
+    object.local_to_world = node->GetTransform().GetLocalToWorldMatrix();
+    object.world_to_local = glm::inverse(object.local_to_world);
+    object.normal_matrix =
+        glm::transpose(glm::inverse(glm::mat3(object.local_to_world)));
+    object.scale = std::cbrt(
+        std::abs(glm::determinant(glm::mat3(object.local_to_world))));
+
+    auto material_component = node->GetComponentPtr<MaterialComponent>();
+    const Material& material = material_component != nullptr
+                                   ? material_component->GetMaterial()
+                                   : Material::GetDefault();
+    object.material.ambient_color = material.GetAmbientColor();
+    object.material.diffuse_color = material.GetDiffuseColor();
+    object.material.specular_color = material.GetSpecularColor();
+    object.material.shininess = material.GetShininess();
+    objects_.push_back(object);
+  }
+
+  lights_.clear();
+  for (auto component : root.GetComponentPtrsInChildren<LightComponent>()) {
+    LightBase* light_ptr = component->GetLightPtr();
+    LightRecord light;
+    light.type = light_ptr->GetType();
+    light.color = light_ptr->GetDiffuseColor();
+    if (light.type == LightType::Point) {
+      auto point_light_ptr = static_cast<PointLight*>(light_ptr);
+      light.position = component->GetNodePtr()->GetTransform().GetPosition();
+      light.attenuation = point_light_ptr->GetAttenuation();
+    } else if (light.type == LightType::Directional) {
+      auto directional_light_ptr = static_cast<DirectionalLight*>(light_ptr);
+      light.direction = directional_light_ptr->GetDirection();
+    } else if (light.type != LightType::Ambient) {
+      throw std::runtime_error("Unrecognized light type in scene!");
+    }
+    lights_.push_back(light);
+  }
+}
+}  // namespace GLOO
@@ -0,0 +1,64 @@
+#ifndef RENDER_SNAPSHOT_H_
+#define RENDER_SNAPSHOT_H_
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "gloo/Scene.hpp"
+#include "gloo/lights/LightBase.hpp"
+
+#include "hittable/HittableBase.hpp"
+
+namespace GLOO {
+struct MaterialRecord {
+  glm::vec3 ambient_color;
+  glm::vec3 diffuse_color;
+  glm::vec3 specular_color;
+  float shininess;
+};
+
+struct ObjectRecord {
+  const HittableBase* hittable;
+  glm::mat4 local_to_world;
+  glm::mat4 world_to_local;
+  // Inverse transpose of the upper 3x3 of local_to_world.
+  glm::mat3 normal_matrix;
+  // Cube root of the volume scale of local_to_world, which turns local
+  // lengths into world lengths for roughly uniform scales.
+  float scale;
+  MaterialRecord material;
+};
+
+struct LightRecord {
+  LightType type;
+  glm::vec3 color;
+  // Point lights only.
+  glm::vec3 position;
+  glm::vec3 attenuation;
+  // Directional lights only.
+  glm::vec3 direction;
+};
+
+// Flat copy of everything the tracer reads from a Scene, compiled once
+// per Render so the inner loop never walks the scene graph, recomputes a
+// matrix, or looks up a component.
+class RenderSnapshot {
+ public:
+  void Compile(const Scene& scene);
+
+  const std::vector<ObjectRecord>& GetObjects() const {
+    return objects_;
+  }
+  // In scene order, so shading sums contributions as before.
+  const std::vector<LightRecord>& GetLights() const {
+    return lights_;
+  }
+
+ private:
+  std::vector<ObjectRecord> objects_;
+  std::vector<LightRecord> lights_;
+};
+}  // namespace GLOO
+
+#endif
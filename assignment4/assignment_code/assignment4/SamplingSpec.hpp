@@ -0,0 +1,57 @@
+#ifndef SAMPLING_SPEC_H_
+#define SAMPLING_SPEC_H_
+
+#include <cstddef>
+
+namespace GLOO {
+// How many samples each pixel gets and when progressive rendering stops
+// or writes intermediate images.
+struct SamplingSpec {
+  // Every progressive pass adds one sample to each pixel.
+  size_t samples_per_pixel = 1;
+  // Seconds after which no more tiles are rendered; 0 means no limit.
+  // The first pass always completes, so every pixel has a sample.
+  double time_budget = 0.0;
+  // Seconds between snapshots of the output image written between
+  // passes; 0 disables them.
+  double snapshot_every = 0.0;
+
+  // Spread the samples of a pixel over a grid of strata, one random
+  // point per stratum, instead of the corner and then uniform points.
+  bool jitter = false;
+  // Blur the resolved image: each pixel becomes the sample-weighted
+  // average of the pixel means of its 3x3 neighbourhood under a tent of
+  // radius 2 pixels. Samples are not kept, so the weights use pixel
+  // centres rather than where each jittered sample landed; this is a
+  // post-blur of pixel means, not a reconstruction filter over sample
+  // positions.
+  bool filter = false;
+  // Filter cube map lookups over each ray's footprint, tracked as a ray
+  // cone from the pixel through its reflections, instead of sampling the
+  // full-resolution map.
+  bool cube_map_lod = false;
+  // A pixel stops receiving samples once it has adaptive_min_samples and
+  // the standard error of its luminance is below adaptive_threshold;
+  // 0 disables adaptive sampling.
+  float adaptive_threshold = 0.0f;
+  size_t adaptive_min_samples = 4;
+
+  // A path stops once no channel of its throughput, the product of the
+  // specular colors along it, is above min_throughput.
+  float min_throughput = 0.0f;
+  // From this many bounces on, paths with throughput below 1 survive each
+  // further bounce with probability equal to their largest channel and
+  // are reweighted to stay unbiased; 0 disables Russian roulette.
+  size_t roulette_depth = 0;
+
+  // Point lights are skipped where their intensity is below light_cutoff
+  // in every channel; 0 evaluates every light everywhere.
+  float light_cutoff = 0.0f;
+  // Shade each hit with this many point lights drawn in proportion to
+  // their unshadowed intensity there, instead of with all of them; 0
+  // disables light sampling. Other lights are always evaluated.
+  size_t light_samples = 0;
+};
+}  // namespace GLOO
+
+#endif
@@ -3,6 +3,7 @@
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/gtx/matrix_decompose.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include <iostream>
 #include <sstream>
 #include <stdexcept>
 
@@ -18,12 +19,16 @@
 
 #include "TracingComponent.hpp"
 #include "hittable/Sphere.hpp"
+#include "hittable/SphereSet.hpp"
 #include "hittable/Plane.hpp"
 #include "hittable/Triangle.hpp"
 #include "hittable/Mesh.hpp"
+#include "AccelCache.hpp"
 
 namespace GLOO {
-SceneParser::SceneParser() {
+SceneParser::SceneParser(AccelType default_accel,
+                         const std::string& accel_cache_dir)
+    : default_accel_(default_accel), accel_cache_dir_(accel_cache_dir) {
 }
 
 std::unique_ptr<Scene> SceneParser::ParseScene(const std::string& filename) {
@@ -36,6 +41,8 @@ std::unique_ptr<Scene> SceneParser::ParseScene(const std::string& filename) {
   }
 
   base_path_ = GetBasePath(file_path);
+  meshes_.clear();
+  num_mesh_instances_ = 0;
 
   std::unique_ptr<Scene> scene;
   std::string token;
@@ -60,7 +67,6 @@ std::unique_ptr<Scene> SceneParser::ParseScene(const std::string& filename) {
   auto ambient_light_node = make_unique<SceneNode>();
   ambient_light_node->CreateComponent<LightComponent>(std::move(ambient_light));
   scene->GetRootNode().AddChild(std::move(ambient_light_node));
-
   return scene;
 }
 
@@ -328,11 +334,76 @@ void SceneParser::ParseTracingComponent(SceneNode& node) {
     object = std::make_shared<Triangle>(v0, v1, v2, n, n, n);
   } else if (type == "mesh") {
     std::string filename;
+    AccelType accel_type = default_accel_;
     fs_ >> token;
     Assert(token, "obj_file");
     fs_ >> filename;
+    while (true) {
+      fs_ >> token;
+      if (token == "accel") {
+        std::string accel;
+        fs_ >> accel;
+        accel_type = ParseAccelType(accel);
+      } else if (token == "}") {
+        break;
+      } else {
+        throw std::runtime_error("Bad mesh token: " + token + "!");
+      }
+    }
+    object = LoadMesh(filename, accel_type);
+    num_mesh_instances_++;
+  } else if (type == "sphere_set") {
+    std::string filename;
+    float radius = 0.0f;
     fs_ >> token;
-    Assert(token, "}");
+    Assert(token, "sphere_file");
+    fs_ >> filename;
+    while (true) {
+      fs_ >> token;
+      if (token == "radius") {
+        radius = ReadFloat();
+        if (!(radius > 0.0f)) {
+          throw std::runtime_error("Bad sphere set radius!");
+        }
+      } else if (token == "}") {
+        break;
+      } else {
+        throw std::runtime_error("Bad sphere set token: " + token + "!");
+      }
+    }
+    auto spheres = std::make_shared<SphereSet>(
+        LoadSphereFile(base_path_ + filename, radius));
+    std::cerr << "Loaded " << spheres->GetNumSpheres() << " spheres from "
+              << filename << std::endl;
+    object = std::move(spheres);
+  } else {
+    throw std::runtime_error("Bad object type: " + type + "!");
+  }
+
+  node.CreateComponent<TracingComponent>(std::move(object));
+}
+
+std::shared_ptr<Mesh> SceneParser::LoadMesh(const std::string& filename,
+                                            AccelType accel_type) {
+  auto key = std::make_pair(base_path_ + filename, accel_type);
+  auto it = meshes_.find(key);
+  if (it != meshes_.end()) {
+    return it->second;
+  }
+
+  bool use_cache = !accel_cache_dir_.empty() && accel_type == AccelType::BVH;
+  std::string cache_path;
+  std::shared_ptr<Mesh> mesh;
+  if (use_cache) {
+    cache_path = GetAccelCachePath(accel_cache_dir_, base_path_ + filename);
+    mesh = LoadCachedMesh(cache_path);
+    // Logged to stderr so stdout stays free for the caller's output.
+    if (mesh != nullptr) {
+      std::cerr << "Loaded " << filename << " from " << cache_path
+                << std::endl;
+    }
+  }
+  if (mesh == nullptr) {
     bool success;
     auto data = ObjParser::Parse(base_path_ + filename, success);
     if (!success || data.positions == nullptr || data.indices == nullptr) {
@@ -341,14 +412,15 @@ void SceneParser::ParseTracingComponent(SceneNode& node) {
     if (data.normals == nullptr) {
       data.normals = CalculateNormals(*data.positions, *data.indices);
     }
-    object = std::make_shared<Mesh>(std::move(data.positions),
-                                    std::move(data.normals),
-                                    std::move(data.indices));
-  } else {
-    throw std::runtime_error("Bad object type: " + type + "!");
+    mesh = std::make_shared<Mesh>(std::move(data.positions),
+                                  std::move(data.normals),
+                                  std::move(data.indices), accel_type);
+    if (use_cache && !SaveCachedMesh(*mesh, cache_path)) {
+      std::cerr << "Could not write accel cache " << cache_path << std::endl;
+    }
   }
-
-  node.CreateComponent<TracingComponent>(std::move(object));
+  meshes_[key] = mesh;
+  return mesh;
 }
 
 glm::vec3 SceneParser::ReadVec3() {
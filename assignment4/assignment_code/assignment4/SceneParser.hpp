@@ -2,6 +2,8 @@
 #define SCENE_PARSER_H_
 
 #include <fstream>
+#include <map>
+#include <utility>
 
 #include "gloo/Scene.hpp"
 #include "gloo/Material.hpp"
@@ -9,12 +11,17 @@
 
 #include "CubeMap.hpp"
 #include "CameraSpec.hpp"
+#include "AccelStructure.hpp"
 
 namespace GLOO {
+class Mesh;
 
 class SceneParser {
  public:
-  SceneParser();
+  // Meshes use default_accel unless their block names another one. With
+  // a non-empty accel_cache_dir, BVH meshes are loaded from and saved to
+  // the accel cache there (see AccelCache).
+  SceneParser(AccelType default_accel, const std::string& accel_cache_dir);
   std::unique_ptr<Scene> ParseScene(const std::string& filename);
   glm::vec3 GetBackgroundColor() const {
     return background_.color;
@@ -25,6 +32,14 @@ class SceneParser {
   const CameraSpec& GetCameraSpec() const {
     return camera_spec_;
   }
+  // Meshes of the last parsed scene: distinct OBJ files (per accel type)
+  // that were loaded, and mesh nodes, which share those as instances.
+  size_t GetNumUniqueMeshes() const {
+    return meshes_.size();
+  }
+  size_t GetNumMeshInstances() const {
+    return num_mesh_instances_;
+  }
 
  private:
   void ParseBackground();
@@ -38,6 +53,10 @@ class SceneParser {
   void ParseLightComponent(SceneNode& node);
   void ParseMaterialComponent(SceneNode& node);
   void ParseTracingComponent(SceneNode& node);
+  // The mesh in the OBJ file at filename, relative to the scene, parsed
+  // and built once per scene and accel type.
+  std::shared_ptr<Mesh> LoadMesh(const std::string& filename,
+                                 AccelType accel_type);
   void Assert(const std::string& token, const std::string& expected);
 
   float ReadFloat();
@@ -53,6 +72,10 @@ class SceneParser {
   } background_;
 
   CameraSpec camera_spec_;
+  AccelType default_accel_;
+  std::string accel_cache_dir_;
+  std::map<std::pair<std::string, AccelType>, std::shared_ptr<Mesh>> meshes_;
+  size_t num_mesh_instances_ = 0;
 
   std::fstream fs_;
   std::string base_path_;
@@ -0,0 +1,126 @@
+#include "TileFile.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+// Bump whenever the file layout changes.
+const uint32_t kTileVersion = 1;
+const char kTileMagic[8] = {'G', 'L', 'O', 'O', 'T', 'I', 'L', 'E'};
+
+struct TileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t image_width;
+  uint32_t image_height;
+  uint32_t x0, y0;
+  uint32_t x1, y1;
+  uint32_t filter;
+};
+
+TileHeader ReadHeader(std::ifstream& in, const std::string& filename) {
+  TileHeader header;
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!in || memcmp(header.magic, kTileMagic, sizeof(kTileMagic)) != 0 ||
+      header.version != kTileVersion) {
+    throw std::runtime_error(filename + " is not a tile file!");
+  }
+  if (header.x0 >= header.x1 || header.y0 >= header.y1 ||
+      header.x1 > header.image_width || header.y1 > header.image_height) {
+    throw std::runtime_error("Bad region in " + filename + "!");
+  }
+  return header;
+}
+
+GLOO::TileInfo GetInfo(const TileHeader& header) {
+  GLOO::TileInfo info;
+  info.image_size = glm::ivec2(header.image_width, header.image_height);
+  info.region = GLOO::Tile{header.x0, header.y0, header.x1, header.y1};
+  info.filter = header.filter != 0;
+  return info;
+}
+}  // namespace
+
+namespace GLOO {
+void SaveTile(const std::string& filename,
+              const TileInfo& info,
+              const AccumulationBuffer& buffer) {
+  const Tile& region = info.region;
+  TileHeader header;
+  memcpy(header.magic, kTileMagic, sizeof(kTileMagic));
+  header.version = kTileVersion;
+  header.image_width = uint32_t(info.image_size.x);
+  header.image_height = uint32_t(info.image_size.y);
+  header.x0 = uint32_t(region.x0);
+  header.y0 = uint32_t(region.y0);
+  header.x1 = uint32_t(region.x1);
+  header.y1 = uint32_t(region.y1);
+  header.filter = info.filter;
+
+  std::vector<glm::vec3> sums;
+  std::vector<uint32_t> counts;
+  for (size_t y = region.y0; y < region.y1; y++) {
+    for (size_t x = region.x0; x < region.x1; x++) {
+      sums.push_back(buffer.GetSum(x, y));
+      counts.push_back(buffer.GetSampleCount(x, y));
+    }
+  }
+
+  std::string temp_filename = filename + ".tmp";
+  {
+    std::ofstream out(temp_filename, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(sums.data()),
+              sums.size() * sizeof(glm::vec3));
+    out.write(reinterpret_cast<const char*>(counts.data()),
+              counts.size() * sizeof(uint32_t));
+    if (!out) {
+      std::remove(temp_filename.c_str());
+      throw std::runtime_error("Cannot write " + filename + "!");
+    }
+  }
+  if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    std::remove(temp_filename.c_str());
+    throw std::runtime_error("Cannot write " + filename + "!");
+  }
+}
+
+TileInfo LoadTileInfo(const std::string& filename) {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Cannot open " + filename + "!");
+  }
+  return GetInfo(ReadHeader(in, filename));
+}
+
+TileInfo MergeTile(const std::string& filename, AccumulationBuffer& buffer) {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Cannot open " + filename + "!");
+  }
+  TileInfo info = GetInfo(ReadHeader(in, filename));
+  const Tile& region = info.region;
+  size_t num_pixels = (region.x1 - region.x0) * (region.y1 - region.y0);
+  std::vector<glm::vec3> sums(num_pixels);
+  std::vector<uint32_t> counts(num_pixels);
+  in.read(reinterpret_cast<char*>(sums.data()),
+          num_pixels * sizeof(glm::vec3));
+  in.read(reinterpret_cast<char*>(counts.data()),
+          num_pixels * sizeof(uint32_t));
+  if (!in) {
+    throw std::runtime_error(filename + " is truncated!");
+  }
+
+  size_t i = 0;
+  for (size_t y = region.y0; y < region.y1; y++) {
+    for (size_t x = region.x0; x < region.x1; x++, i++) {
+      buffer.AddSamples(x, y, sums[i], counts[i]);
+    }
+  }
+  return info;
+}
+}  // namespace GLOO
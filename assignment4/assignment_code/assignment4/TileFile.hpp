@@ -0,0 +1,37 @@
+#ifndef TILE_FILE_H_
+#define TILE_FILE_H_
+
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "AccumulationBuffer.hpp"
+#include "TileQueue.hpp"
+
+namespace GLOO {
+// Tile files hold what a -region render accumulated for its part of an
+// image: a header, each pixel's sample sum as three floats and then each
+// pixel's sample count, both row by row from the region's bottom row.
+// Sample seeds depend only on the pixel and the sample number, so the
+// tiles of a whole image merge into exactly the buffer a single render
+// accumulates. Stored in native byte order.
+struct TileInfo {
+  glm::ivec2 image_size;
+  Tile region;
+  // Whether the merged image is resolved with the tent blur.
+  bool filter;
+};
+
+// Writes the pixels of info.region in buffer to filename through a
+// temporary file that is then renamed.
+void SaveTile(const std::string& filename,
+              const TileInfo& info,
+              const AccumulationBuffer& buffer);
+// Reads the header of the tile file at filename.
+TileInfo LoadTileInfo(const std::string& filename);
+// Adds the samples in the tile file at filename to buffer, which must
+// cover the tile's region, and returns its header.
+TileInfo MergeTile(const std::string& filename, AccumulationBuffer& buffer);
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,77 @@
+#include "TileQueue.hpp"
+
+#include <algorithm>
+
+#include "gloo/utils.hpp"
+
+namespace GLOO {
+TileQueue::TileQueue(const glm::ivec2& image_size,
+                     size_t tile_size,
+                     size_t num_workers)
+    : TileQueue(Tile{0, 0, size_t(image_size.x), size_t(image_size.y)},
+                tile_size,
+                num_workers) {
+}
+
+TileQueue::TileQueue(const Tile& region,
+                     size_t tile_size,
+                     size_t num_workers) {
+  num_workers = std::max<size_t>(num_workers, 1);
+  tile_size = std::max<size_t>(tile_size, 1);
+
+  std::vector<Tile> tiles;
+  for (size_t y0 = region.y0; y0 < region.y1; y0 += tile_size) {
+    for (size_t x0 = region.x0; x0 < region.x1; x0 += tile_size) {
+      Tile tile;
+      tile.x0 = x0;
+      tile.y0 = y0;
+      tile.x1 = std::min(x0 + tile_size, region.x1);
+      tile.y1 = std::min(y0 + tile_size, region.y1);
+      tiles.push_back(tile);
+    }
+  }
+  num_tiles_ = tiles.size();
+
+  // Hand out contiguous runs so that neighboring tiles (and the geometry
+  // they see) stay on the same worker until stealing kicks in.
+  for (size_t w = 0; w < num_workers; w++) {
+    deques_.push_back(make_unique<WorkerDeque>());
+    size_t begin = w * num_tiles_ / num_workers;
+    size_t end = (w + 1) * num_tiles_ / num_workers;
+    deques_.back()->tiles.assign(tiles.begin() + begin, tiles.begin() + end);
+  }
+}
+
+bool TileQueue::Pop(size_t worker, Tile& tile) {
+  size_t num_workers = deques_.size();
+  if (PopFront(*deques_[worker % num_workers], tile)) {
+    return true;
+  }
+  for (size_t i = 1; i < num_workers; i++) {
+    if (PopBack(*deques_[(worker + i) % num_workers], tile)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TileQueue::PopFront(WorkerDeque& deque, Tile& tile) {
+  std::lock_guard<std::mutex> lock(deque.mutex);
+  if (deque.tiles.empty()) {
+    return false;
+  }
+  tile = deque.tiles.front();
+  deque.tiles.pop_front();
+  return true;
+}
+
+bool TileQueue::PopBack(WorkerDeque& deque, Tile& tile) {
+  std::lock_guard<std::mutex> lock(deque.mutex);
+  if (deque.tiles.empty()) {
+    return false;
+  }
+  tile = deque.tiles.back();
+  deque.tiles.pop_back();
+  return true;
+}
+}  // namespace GLOO
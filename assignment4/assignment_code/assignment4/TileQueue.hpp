@@ -0,0 +1,49 @@
+#ifndef TILE_QUEUE_H_
+#define TILE_QUEUE_H_
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace GLOO {
+// A rectangular block of pixels [x0, x1) x [y0, y1).
+struct Tile {
+  size_t x0, y0;
+  size_t x1, y1;
+};
+
+// Work-stealing queue of image tiles. Each worker owns a deque that is
+// seeded with a contiguous run of tiles; a worker pops from the front of
+// its own deque and, once that is empty, steals from the back of another
+// worker's deque.
+class TileQueue {
+ public:
+  TileQueue(const glm::ivec2& image_size, size_t tile_size, size_t num_workers);
+  // Tiles of region only.
+  TileQueue(const Tile& region, size_t tile_size, size_t num_workers);
+
+  // Returns false once every tile has been handed out.
+  bool Pop(size_t worker, Tile& tile);
+
+  size_t GetNumTiles() const {
+    return num_tiles_;
+  }
+
+ private:
+  struct WorkerDeque {
+    std::mutex mutex;
+    std::deque<Tile> tiles;
+  };
+
+  bool PopFront(WorkerDeque& deque, Tile& tile);
+  bool PopBack(WorkerDeque& deque, Tile& tile);
+
+  std::vector<std::unique_ptr<WorkerDeque>> deques_;
+  size_t num_tiles_;
+};
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,186 @@
+#include "TopLevelAccel.hpp"
+
+namespace GLOO {
+void TopLevelAccel::Build(const std::vector<ObjectRecord>& objects) {
+  objects_ = &objects;
+  hittables_.clear();
+  for (auto& object : objects) {
+    hittables_.push_back(object.hittable);
+  }
+  UpdateBounds();
+
+  unbounded_.clear();
+  bounded_.clear();
+  std::vector<AABB> bounds;
+  for (size_t i = 0; i < objects.size(); i++) {
+    if (world_bounds_[i].IsFinite()) {
+      bounded_.push_back(i);
+      bounds.push_back(world_bounds_[i]);
+    } else {
+      unbounded_.push_back(i);
+    }
+  }
+  // A rebuild may leave nothing bounded; drop the old nodes then too.
+  if (bounds.empty()) {
+    bvh_.Clear();
+  } else {
+    bvh_.BuildFromBounds(bounds);
+  }
+}
+
+void TopLevelAccel::Refit(const std::vector<ObjectRecord>& objects) {
+  objects_ = &objects;
+  UpdateBounds();
+  if (bounded_.empty()) {
+    return;
+  }
+  std::vector<AABB> bounds;
+  bounds.reserve(bounded_.size());
+  for (size_t index : bounded_) {
+    bounds.push_back(world_bounds_[index]);
+  }
+  bvh_.Refit(bounds);
+}
+
+bool TopLevelAccel::IsBuiltFor(const std::vector<ObjectRecord>& objects) const {
+  if (objects.size() != hittables_.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < objects.size(); i++) {
+    if (objects[i].hittable != hittables_[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void TopLevelAccel::UpdateBounds() {
+  const std::vector<ObjectRecord>& objects = *objects_;
+  world_bounds_.resize(objects.size());
+  for (size_t i = 0; i < objects.size(); i++) {
+    AABB local_bounds = objects[i].hittable->GetLocalBounds();
+    world_bounds_[i] = local_bounds.IsFinite()
+                           ? local_bounds.Transform(objects[i].local_to_world)
+                           : local_bounds;
+  }
+}
+
+bool TopLevelAccel::IntersectInstance(size_t index,
+                                      const Ray& ray,
+                                      float t_min,
+                                      HitRecord& record) const {
+  // ApplyTransform keeps At(1) fixed, so local and world hits share t.
+  const ObjectRecord& object = (*objects_)[index];
+  Ray local_ray = ray;
+  local_ray.ApplyTransform(object.world_to_local);
+  return object.hittable->Intersect(local_ray, t_min, record);
+}
+
+unsigned TopLevelAccel::IntersectInstancePacket(size_t index,
+                                               const RayPacket& packet,
+                                               float t_min,
+                                               HitRecord* records,
+                                               size_t* object_indices) const {
+  const ObjectRecord& object = (*objects_)[index];
+  RayPacket local_packet = packet;
+  local_packet.ApplyTransform(object.world_to_local);
+  unsigned hit =
+      object.hittable->IntersectPacket(local_packet, t_min, records);
+  for (int lane = 0; lane < kPacketSize; lane++) {
+    if (hit & (1u << lane)) {
+      object_indices[lane] = index;
+    }
+  }
+  return hit;
+}
+
+bool TopLevelAccel::OccludedInstance(size_t index,
+                                     const Ray& ray,
+                                     float t_min,
+                                     float t_max) const {
+  const ObjectRecord& object = (*objects_)[index];
+  Ray local_ray = ray;
+  local_ray.ApplyTransform(object.world_to_local);
+  return object.hittable->Occluded(local_ray, t_min, t_max);
+}
+
+bool TopLevelAccel::Intersect(const Ray& ray,
+                              float t_min,
+                              HitRecord& record,
+                              size_t& object_index) const {
+  bool intersected = false;
+  for (size_t index : unbounded_) {
+    if (IntersectInstance(index, ray, t_min, record)) {
+      intersected = true;
+      object_index = index;
+    }
+  }
+  if (bounded_.empty()) {
+    return intersected;
+  }
+  intersected |= bvh_.Traverse(ray, t_min, record,
+                               [&](uint32_t prim, HitRecord& rec) {
+                                 size_t index = bounded_[prim];
+                                 if (!IntersectInstance(index, ray, t_min,
+                                                        rec)) {
+                                   return false;
+                                 }
+                                 object_index = index;
+                                 return true;
+                               });
+  return intersected;
+}
+
+unsigned TopLevelAccel::IntersectPacket(const RayPacket& packet,
+                                       float t_min,
+                                       HitRecord* records,
+                                       size_t* object_indices) const {
+  unsigned intersected = 0;
+  for (size_t index : unbounded_) {
+    intersected |=
+        IntersectInstancePacket(index, packet, t_min, records, object_indices);
+  }
+  if (bounded_.empty()) {
+    return intersected;
+  }
+  intersected |= bvh_.TraversePacket(
+      packet, t_min, records,
+      [&](const BVHNode& leaf, unsigned lanes, HitRecord* recs) {
+        RayPacket active = packet;
+        active.mask = lanes;
+        unsigned hit = 0;
+        for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+          hit |= IntersectInstancePacket(bounded_[bvh_.GetPrimIndex(i)],
+                                         active, t_min, recs,
+                                         object_indices);
+        }
+        return hit;
+      },
+      [&](int lane, const BVHNode& leaf, HitRecord& rec) {
+        bool hit = false;
+        for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+          size_t index = bounded_[bvh_.GetPrimIndex(i)];
+          if (IntersectInstance(index, packet.GetRay(lane), t_min, rec)) {
+            object_indices[lane] = index;
+            hit = true;
+          }
+        }
+        return hit;
+      });
+  return intersected;
+}
+
+bool TopLevelAccel::Occluded(const Ray& ray, float t_min, float t_max) const {
+  for (size_t index : unbounded_) {
+    if (OccludedInstance(index, ray, t_min, t_max)) {
+      return true;
+    }
+  }
+  if (bounded_.empty()) {
+    return false;
+  }
+  return bvh_.TraverseAny(ray, t_min, t_max, [&](uint32_t prim) {
+    return OccludedInstance(bounded_[prim], ray, t_min, t_max);
+  });
+}
+}  // namespace GLOO
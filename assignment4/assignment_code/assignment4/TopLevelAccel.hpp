@@ -0,0 +1,70 @@
+#ifndef TOP_LEVEL_ACCEL_H_
+#define TOP_LEVEL_ACCEL_H_
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "BVH.hpp"
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+#include "HitRecord.hpp"
+#include "RenderSnapshot.hpp"
+
+namespace GLOO {
+// Two-level acceleration structure: a BVH over the world-space bounds of
+// every object in a RenderSnapshot, so whole objects are culled before a
+// ray is moved into an object's local space for its own Intersect.
+class TopLevelAccel {
+ public:
+  // Builds the hierarchy from scratch. The objects must outlive any
+  // Intersect call.
+  void Build(const std::vector<ObjectRecord>& objects);
+  // Refits the existing hierarchy to the objects' current transforms;
+  // cheaper than Build when only transforms have changed.
+  void Refit(const std::vector<ObjectRecord>& objects);
+  bool IsBuiltFor(const std::vector<ObjectRecord>& objects) const;
+
+  // Ray is in world coordinates. On a closer hit, record is updated and
+  // object_index names the object that was hit.
+  bool Intersect(const Ray& ray,
+                 float t_min,
+                 HitRecord& record,
+                 size_t& object_index) const;
+  // Intersect for every active ray of packet at once; object_indices is
+  // indexed by lane. Returns the lanes that got a closer hit.
+  unsigned IntersectPacket(const RayPacket& packet,
+                           float t_min,
+                           HitRecord* records,
+                           size_t* object_indices) const;
+  // Whether any object blocks the ray within [t_min, t_max].
+  bool Occluded(const Ray& ray, float t_min, float t_max) const;
+
+ private:
+  void UpdateBounds();
+  bool IntersectInstance(size_t index,
+                         const Ray& ray,
+                         float t_min,
+                         HitRecord& record) const;
+  unsigned IntersectInstancePacket(size_t index,
+                                   const RayPacket& packet,
+                                   float t_min,
+                                   HitRecord* records,
+                                   size_t* object_indices) const;
+  bool OccludedInstance(size_t index,
+                        const Ray& ray,
+                        float t_min,
+                        float t_max) const;
+
+  const std::vector<ObjectRecord>* objects_ = nullptr;
+  std::vector<const HittableBase*> hittables_;
+  // Planes and other unbounded objects are tested against every ray.
+  std::vector<size_t> unbounded_;
+  // BVH primitive i is instance bounded_[i].
+  std::vector<size_t> bounded_;
+  std::vector<AABB> world_bounds_;
+  BVH bvh_;
+};
+}  // namespace GLOO
+
+#endif
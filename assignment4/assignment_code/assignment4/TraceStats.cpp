@@ -0,0 +1,108 @@
+#include "TraceStats.hpp"
+
+#include <mutex>
+
+namespace GLOO {
+void TraceStats::Merge(const TraceStats& other) {
+  node_visits += other.node_visits;
+  triangle_tests += other.triangle_tests;
+  mailbox_skips += other.mailbox_skips;
+  hits += other.hits;
+}
+
+std::ostream& operator<<(std::ostream& os, const TraceStats& stats) {
+  os << "Trace stats:\n";
+  os << "- node visits: " << stats.node_visits << "\n";
+  os << "- triangle tests: " << stats.triangle_tests << "\n";
+  os << "- mailbox skips: " << stats.mailbox_skips << "\n";
+  os << "- hits: " << stats.hits << "\n";
+  return os;
+}
+
+void RayCounts::Merge(const RayCounts& other) {
+  primary += other.primary;
+  reflection += other.reflection;
+  shadow += other.shadow;
+}
+
+namespace {
+std::mutex ray_counts_mutex;
+RayCounts total_ray_counts;
+}  // namespace
+
+RayCounts& LocalRayCounts() {
+  static thread_local RayCounts counts;
+  return counts;
+}
+
+void FlushLocalRayCounts() {
+  RayCounts& local = LocalRayCounts();
+  std::lock_guard<std::mutex> lock(ray_counts_mutex);
+  total_ray_counts.Merge(local);
+  local = RayCounts();
+}
+
+RayCounts TakeRayCounts() {
+  std::lock_guard<std::mutex> lock(ray_counts_mutex);
+  RayCounts result = total_ray_counts;
+  total_ray_counts = RayCounts();
+  return result;
+}
+
+std::ostream& operator<<(std::ostream& os, const RayCounts& counts) {
+  os << "Ray counts:\n";
+  os << "- primary rays: " << counts.primary << "\n";
+  os << "- reflection rays: " << counts.reflection << "\n";
+  os << "- shadow rays: " << counts.shadow << "\n";
+  return os;
+}
+
+void PrintStatsSummary(std::ostream& os) {
+  RayCounts counts = TakeRayCounts();
+  os << counts;
+#ifdef TRACER_STATS
+  TraceStats stats = TakeTraceStats();
+  os << stats;
+  uint64_t rays = counts.GetTotal();
+  if (rays > 0) {
+    os << "- node visits per ray: " << double(stats.node_visits) / rays
+       << "\n";
+    os << "- triangle tests per ray: "
+       << double(stats.triangle_tests) / rays << "\n";
+  }
+  uint64_t closest_hit_rays = counts.primary + counts.reflection;
+  if (closest_hit_rays > 0) {
+    os << "- hit rate of primary and reflection rays: "
+       << double(stats.hits) / closest_hit_rays << "\n";
+  }
+#else
+  os << "Traversal counters need a build with TRACER_STATS.\n";
+#endif
+}
+
+#ifdef TRACER_STATS
+namespace {
+std::mutex total_mutex;
+TraceStats total_stats;
+}  // namespace
+
+TraceStats& LocalTraceStats() {
+  static thread_local TraceStats stats;
+  return stats;
+}
+
+void FlushLocalTraceStats() {
+  TraceStats& local = LocalTraceStats();
+  std::lock_guard<std::mutex> lock(total_mutex);
+  total_stats.Merge(local);
+  local = TraceStats();
+}
+
+TraceStats TakeTraceStats() {
+  std::lock_guard<std::mutex> lock(total_mutex);
+  TraceStats result = total_stats;
+  total_stats = TraceStats();
+  return result;
+}
+#endif
+}  // namespace GLOO
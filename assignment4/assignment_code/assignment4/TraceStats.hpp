@@ -0,0 +1,77 @@
+#ifndef TRACE_STATS_H_
+#define TRACE_STATS_H_
+
+#include <cstdint>
+#include <ostream>
+
+namespace GLOO {
+// Traversal counters. They are only maintained when the tracer is built
+// with TRACER_STATS; otherwise TRACE_STATS_INC expands to nothing and the
+// hot loops carry no extra work.
+struct TraceStats {
+  uint64_t node_visits = 0;
+  // Ray-primitive tests in leaves: triangles, and the spheres of sphere
+  // sets.
+  uint64_t triangle_tests = 0;
+  // Triangle tests skipped because the ray had already tested that
+  // triangle in another octree leaf.
+  uint64_t mailbox_skips = 0;
+  // Closest-hit queries of the tracer that found a surface.
+  uint64_t hits = 0;
+
+  // Node visits plus triangle tests, the work the heatmap shows.
+  uint64_t GetTraversalCost() const {
+    return node_visits + triangle_tests;
+  }
+  void Merge(const TraceStats& other);
+};
+
+std::ostream& operator<<(std::ostream& os, const TraceStats& stats);
+
+// Rays traced, by kind. Unlike the traversal counters these cost one
+// increment per ray, not per node, so they are always kept.
+struct RayCounts {
+  uint64_t primary = 0;
+  uint64_t reflection = 0;
+  uint64_t shadow = 0;
+
+  uint64_t GetTotal() const {
+    return primary + reflection + shadow;
+  }
+  void Merge(const RayCounts& other);
+};
+
+// Counts of the calling thread.
+RayCounts& LocalRayCounts();
+// Adds the calling thread's counts to the global total and clears them.
+void FlushLocalRayCounts();
+// Returns the global total and resets it.
+RayCounts TakeRayCounts();
+
+std::ostream& operator<<(std::ostream& os, const RayCounts& counts);
+
+// Prints and resets the global ray counts and, in TRACER_STATS builds,
+// the traversal counters with their averages per ray.
+void PrintStatsSummary(std::ostream& os);
+
+#ifdef TRACER_STATS
+// Counters of the calling thread.
+TraceStats& LocalTraceStats();
+// Adds the calling thread's counters to the global total and clears them.
+void FlushLocalTraceStats();
+// Returns the global total and resets it.
+TraceStats TakeTraceStats();
+
+#define TRACE_STATS_INC(counter) (++::GLOO::LocalTraceStats().counter)
+#define TRACE_STATS_ADD(counter, n) (::GLOO::LocalTraceStats().counter += (n))
+#else
+#define TRACE_STATS_INC(counter) \
+  do {                           \
+  } while (0)
+#define TRACE_STATS_ADD(counter, n) \
+  do {                              \
+  } while (0)
+#endif
+}  // namespace GLOO
+
+#endif
@@ -3,147 +3,1036 @@
 #include <glm/gtx/string_cast.hpp>
 #include <stdexcept>
 #include <algorithm>
-
-#include "gloo/Transform.hpp"
-#include "gloo/components/MaterialComponent.hpp"
-#include "gloo/lights/AmbientLight.hpp"
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <thread>
+#include <iostream>
 
 #include "gloo/Image.hpp"
+#include "gloo/utils.hpp"
 #include "Illuminator.hpp"
+#include "PNGStreamWriter.hpp"
+#include "Random.hpp"
+#include "TileFile.hpp"
+#include "TraceStats.hpp"
 
 #include "glm/gtx/string_cast.hpp"
 
+namespace {
+// Tiles are small enough to balance well across threads and large enough
+// that a tile's rays mostly touch the same part of the scene.
+const size_t kTileSize = 16;
+// Streamed renders work on bands of whole tile rows holding at least this
+// many tiles per thread.
+const size_t kMinBandTilesPerThread = 4;
+const size_t kNoObject = std::numeric_limits<size_t>::max();
+// Pixels per wavefront batch: enough rays per stage to keep the binning
+// and sorting worthwhile, few enough that the batch stays in cache-sized
+// buffers. Batches shrink so that their shadow slots stay bounded.
+const size_t kWavefrontBatchSize = 1 << 16;
+const size_t kMinWavefrontBatchSize = 1 << 10;
+const size_t kMaxShadowSlots = 1 << 20;
+
+// Seed of the random decisions along the path of a pixel sample.
+uint32_t PathSeed(size_t x, size_t y, size_t sample) {
+  using GLOO::HashUint;
+  // The constant keeps the seeds apart from the pixel offsets' hashes.
+  return HashUint(uint32_t(x) +
+                  HashUint(uint32_t(y) + HashUint(uint32_t(sample) +
+                                                  0x9e3779b9u)));
+}
+
+// Seed of the light sampling at bounce `depth` of a path; kept apart
+// from the roulette's HashUint(path_seed + depth).
+uint32_t LightSeed(uint32_t path_seed, size_t depth) {
+  using GLOO::HashUint;
+  return HashUint(HashUint(path_seed + uint32_t(depth)) + 0x7f4a7c15u);
+}
+
+// Writes image next to filename and renames it into place, so a reader
+// or a killed render never leaves a partially written file behind.
+void SavePNGAtomically(const GLOO::Image& image, const std::string& filename) {
+  std::string temp_filename = filename + ".tmp.png";
+  image.SavePNG(temp_filename);
+  if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    throw std::runtime_error("Cannot write " + filename + "!");
+  }
+}
+}  // namespace
+
 namespace GLOO {
-void Tracer::Render(const Scene& scene, const std::string& output_file) {
+size_t Tracer::PrepareRender(const Scene& scene) {
   scene_ptr_ = &scene;
 
-  auto& root = scene_ptr_->GetRootNode();
-  tracing_components_ = root.GetComponentPtrsInChildren<TracingComponent>();
-  light_components_ = root.GetComponentPtrsInChildren<LightComponent>();
+  // Everything TraceRay needs is baked here once; the scene graph is not
+  // touched again until the next Render.
+  snapshot_.Compile(scene);
+  if (top_level_.IsBuiltFor(snapshot_.GetObjects())) {
+    top_level_.Refit(snapshot_.GetObjects());
+  } else {
+    top_level_.Build(snapshot_.GetObjects());
+  }
+  light_bvh_.Build(snapshot_.GetLights(), sampling_.light_cutoff);
+
+  size_t num_samples = std::max<size_t>(sampling_.samples_per_pixel, 1);
+  // A pixel's samples together cover it, so each one filters over a
+  // share of its area.
+  primary_cone_ = RayCone();
+  primary_cone_.spread = camera_.GetPixelSpread(image_size_.y) /
+                         std::sqrt(float(num_samples));
+  strata_levels_ = 0;
+  while (strata_levels_ < 15 &&
+         (uint64_t(1) << (2 * strata_levels_)) < num_samples) {
+    strata_levels_++;
+  }
+  return num_samples;
+}
 
 
+void Tracer::Render(const Scene& scene,
+                    const std::string& output_file,
+                    const AovOutputs& aov_outputs) {
+  if (aov_outputs.heatmap_file.size()) {
+#ifndef TRACER_STATS
+    throw std::runtime_error("The heatmap needs a build with TRACER_STATS!");
+#endif
+    if (wavefront_enabled_) {
+      throw std::runtime_error("The heatmap needs the path engine!");
+    }
+  }
+  size_t num_samples = PrepareRender(scene);
+
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point start = Clock::now();
+  auto seconds_since = [](Clock::time_point time) {
+    return std::chrono::duration<double>(Clock::now() - time).count();
+  };
+  Clock::time_point deadline = Clock::time_point::max();
+  if (sampling_.time_budget > 0.0) {
+    deadline = start + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(
+                               sampling_.time_budget));
+  }
+
+  AccumulationBuffer buffer(image_size_);
+  std::unique_ptr<AovBuffer> aovs;
+  if (!aov_outputs.IsEmpty()) {
+    aovs = make_unique<AovBuffer>(image_size_);
+  }
   Image image(image_size_.x, image_size_.y);
+  Tile region{0, 0, size_t(image_size_.x), size_t(image_size_.y)};
+  Clock::time_point last_snapshot = start;
+  size_t pass = 0;
+  while (pass < num_samples) {
+    Clock::time_point pass_deadline =
+        pass == 0 ? Clock::time_point::max() : deadline;
+    AovBuffer* pass_aovs = pass == 0 ? aovs.get() : nullptr;
+    bool complete =
+        wavefront_enabled_
+            ? RenderPassWavefront(pass, region, pass_deadline, buffer,
+                                  pass_aovs)
+            : RenderPass(pass, region, pass_deadline, buffer, pass_aovs);
+    pass++;
+    if (!complete || Clock::now() >= deadline) {
+      break;
+    }
+    if (sampling_.adaptive_threshold > 0.0f &&
+        buffer.UpdateActivePixels(sampling_.adaptive_threshold,
+                                  sampling_.adaptive_min_samples) == 0) {
+      break;
+    }
+    if (sampling_.snapshot_every > 0.0 && pass < num_samples &&
+        seconds_since(last_snapshot) >= sampling_.snapshot_every &&
+        output_file.size()) {
+      buffer.Resolve(image, sampling_.filter);
+      SavePNGAtomically(image, output_file);
+      last_snapshot = Clock::now();
+      std::cout << "Snapshot after " << pass << " samples per pixel"
+                << std::endl;
+    }
+  }
+  if (num_samples > 1) {
+    std::cout << "Rendered up to " << pass << " of " << num_samples
+              << " samples per pixel in " << seconds_since(start) << " s, "
+              << double(buffer.GetTotalSampleCount()) /
+                     (image_size_.x * image_size_.y)
+              << " on average" << std::endl;
+  }
+  buffer.Resolve(image, sampling_.filter);
+  if (output_file.size())
+    SavePNGAtomically(image, output_file);
+  if (aovs != nullptr) {
+    if (aov_outputs.depth_file.size()) {
+      aovs->ResolveDepth(image, aov_outputs.depth_min, aov_outputs.depth_max);
+      SavePNGAtomically(image, aov_outputs.depth_file);
+    }
+    if (aov_outputs.normals_file.size()) {
+      aovs->ResolveNormals(image);
+      SavePNGAtomically(image, aov_outputs.normals_file);
+    }
+    if (aov_outputs.ids_file.size()) {
+      aovs->ResolveIds(image);
+      SavePNGAtomically(image, aov_outputs.ids_file);
+    }
+    if (aov_outputs.heatmap_file.size()) {
+      float max_cost = aovs->ResolveCost(image);
+      SavePNGAtomically(image, aov_outputs.heatmap_file);
+      std::cout << "Heatmap: red is " << max_cost
+                << " node visits and triangle tests or more" << std::endl;
+    }
+  }
+}
 
 
-  for (size_t y = 0; y < image_size_.y; y++) {
-    for (size_t x = 0; x < image_size_.x; x++) {
-      // TODO: For each pixel, cast a ray, and update its value in the image.
-      
-      float x_norm = float(x) / image_size_.x * 2 - 1;
-      float y_norm = float(y) / image_size_.y * 2 - 1;
-      Ray ray = camera_.GenerateRay(glm::vec2(x_norm, y_norm));
-      HitRecord record;
-      glm::vec3 color = TraceRay(ray, max_bounces_, record);
-      image.SetPixel(x, y, color);
+void Tracer::RenderStreaming(const Scene& scene,
+                             const std::string& output_file) {
+  if (sampling_.filter || sampling_.time_budget > 0.0 ||
+      sampling_.snapshot_every > 0.0) {
+    throw std::runtime_error(
+        "Streamed output supports no filter, time budget or snapshots!");
+  }
+  if (output_file.empty()) {
+    throw std::runtime_error("Streamed output needs an output file!");
+  }
+  size_t num_samples = PrepareRender(scene);
+
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point start = Clock::now();
+  size_t width = image_size_.x;
+  size_t height = image_size_.y;
+  size_t num_threads = std::max<size_t>(num_threads_, 1);
+  size_t tiles_per_row = (width + kTileSize - 1) / kTileSize;
+  size_t band_tile_rows =
+      std::max<size_t>(1, (kMinBandTilesPerThread * num_threads +
+                           tiles_per_row - 1) / tiles_per_row);
+  size_t band_height = band_tile_rows * kTileSize;
+
+  PNGStreamWriter writer(output_file, width, height);
+  uint64_t total_samples = 0;
+  // The file starts with the top row of the image, its last one.
+  for (size_t y1 = height; y1 > 0;) {
+    size_t y0 = y1 > band_height ? y1 - band_height : 0;
+    Tile band{0, y0, width, y1};
+    glm::ivec2 band_size(width, y1 - y0);
+    AccumulationBuffer buffer(band_size, glm::ivec2(0, y0));
+    AccumulateRegion(band, num_samples, buffer);
+    total_samples += buffer.GetTotalSampleCount();
+
+    Image image(band_size.x, band_size.y);
+    buffer.Resolve(image, false);
+    std::vector<uint8_t> rows = image.ToByteData();
+    writer.WriteRows(rows.data(), band_size.y);
+    y1 = y0;
+  }
+  writer.Close();
+
+  if (num_samples > 1) {
+    std::cout << "Rendered " << num_samples << " samples per pixel in "
+              << std::chrono::duration<double>(Clock::now() - start).count()
+              << " s, " << double(total_samples) / (width * height)
+              << " on average" << std::endl;
+  }
+}
+
+
+void Tracer::RenderRegion(const Scene& scene,
+                          const Tile& region,
+                          const std::string& output_file) {
+  if (sampling_.adaptive_threshold > 0.0f || sampling_.time_budget > 0.0 ||
+      sampling_.snapshot_every > 0.0) {
+    throw std::runtime_error(
+        "Region renders need a fixed number of samples per pixel!");
+  }
+  if (region.x0 >= region.x1 || region.y0 >= region.y1 ||
+      region.x1 > size_t(image_size_.x) || region.y1 > size_t(image_size_.y)) {
+    throw std::runtime_error("Region is empty or outside the image!");
+  }
+  if (output_file.empty()) {
+    throw std::runtime_error("Region renders need an output file!");
+  }
+  size_t num_samples = PrepareRender(scene);
+
+  glm::ivec2 region_size(region.x1 - region.x0, region.y1 - region.y0);
+  AccumulationBuffer buffer(region_size, glm::ivec2(region.x0, region.y0));
+  AccumulateRegion(region, num_samples, buffer);
+
+  TileInfo info;
+  info.image_size = image_size_;
+  info.region = region;
+  info.filter = sampling_.filter;
+  SaveTile(output_file, info, buffer);
+}
+
+
+void Tracer::AccumulateRegion(const Tile& region,
+                              size_t num_samples,
+                              AccumulationBuffer& buffer) const {
+  using Clock = std::chrono::steady_clock;
+  for (size_t pass = 0; pass < num_samples; pass++) {
+    if (wavefront_enabled_) {
+      RenderPassWavefront(pass, region, Clock::time_point::max(), buffer,
+                          nullptr);
+    } else {
+      RenderPass(pass, region, Clock::time_point::max(), buffer, nullptr);
+    }
+    if (sampling_.adaptive_threshold > 0.0f &&
+        buffer.UpdateActivePixels(sampling_.adaptive_threshold,
+                                  sampling_.adaptive_min_samples) == 0) {
+      break;
     }
   }
+}
 
-  if (output_file.size())
-    image.SavePNG(output_file);
+
+bool Tracer::RenderPass(size_t sample,
+                        const Tile& region,
+                        std::chrono::steady_clock::time_point deadline,
+                        AccumulationBuffer& buffer,
+                        AovBuffer* aovs) const {
+  // Every pixel is traced independently, so the tiles can be rendered in
+  // any order and on any thread without changing the result.
+  size_t num_threads = std::max<size_t>(num_threads_, 1);
+  TileQueue tile_queue(region, kTileSize, num_threads);
+  std::atomic<bool> stopped(false);
+  auto worker = [&](size_t worker_id) {
+    Tile tile;
+    while (tile_queue.Pop(worker_id, tile)) {
+      if (deadline != std::chrono::steady_clock::time_point::max() &&
+          std::chrono::steady_clock::now() >= deadline) {
+        stopped = true;
+        break;
+      }
+      RenderTile(tile, sample, buffer, aovs);
+    }
+    FlushLocalRayCounts();
+#ifdef TRACER_STATS
+    FlushLocalTraceStats();
+#endif
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(worker, i);
+  }
+  worker(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return !stopped;
 }
 
 
-glm::vec3 Tracer::TraceRay(const Ray& ray,
-                           size_t bounces,
-                           HitRecord& record) const {
-  // TODO: Compute the color for the cast ray.
-  // return GetBackgroundColor(ray.GetDirection());
-
-  glm::vec3 pixel_color(0.0f);
-  bool hit = false;
-
-  for (auto& single_tracing : tracing_components_) {
-    glm::mat4 transform = single_tracing->GetNodePtr()->GetTransform().GetLocalToWorldMatrix();
-    glm::mat4 inv = glm::inverse(transform);
-    Ray temp_ray = ray;
-    temp_ray.ApplyTransform(inv);
-
-    const auto& hittable = single_tracing->GetHittable();
-    if (hittable.Intersect(temp_ray, camera_.GetTMin(), record)) {
-      hit = true;
-
-      record.normal = glm::normalize(glm::transpose(glm::inverse(glm::mat3(transform))) * record.normal);
-      pixel_color = glm::vec3(0.0f);
-      
-      temp_ray.ApplyTransform(transform);
-      const glm::vec3& hit_pos = temp_ray.At(record.time);
-
-      glm::vec3 I(0.0f);
-      glm::vec3 I_indirect(0.0f);
-
-      for (auto& single_light : light_components_) {
-        // Point light & directional light
-        if (single_light->GetLightPtr()->GetType() == LightType::Point || single_light->GetLightPtr()->GetType() == LightType::Directional) {
-          // Diffuse shading
-          glm::vec3 dir_to_light(0.0f);
-          glm::vec3 intensity(0.0f);
-          float dist_to_light = 0.0f;
-          Illuminator::GetIllumination(*single_light, hit_pos, dir_to_light, intensity, dist_to_light);
-          glm::vec3 k_diffuse = single_tracing->GetNodePtr()->GetComponentPtr<MaterialComponent>()->GetMaterial().GetDiffuseColor();
-          glm::vec3 I_diffuse = GetDiffuseShading(dir_to_light, record.normal, intensity, k_diffuse);
-
-          // Specular shading
-          glm::vec3 surface_to_eye = temp_ray.GetDirection();
-          glm::vec3 k_specular = single_tracing->GetNodePtr()->GetComponentPtr<MaterialComponent>()->GetMaterial().GetSpecularColor();
-          float shininess = single_tracing->GetNodePtr()->GetComponentPtr<MaterialComponent>()->GetMaterial().GetShininess();
-          glm::vec3 I_specular = GetSpecularShading(shininess, dir_to_light, surface_to_eye, record.normal, intensity, k_specular);
-
-          // Check shadow
-          HitRecord shadow_record;
-          glm::vec3 light_dir_epsilon = dir_to_light * glm::vec3(0.01);
-          Ray shadow_ray(hit_pos + light_dir_epsilon, dir_to_light);
-          bool shadow_exists = false;
-
-          for (auto& single_object : tracing_components_) {
-            glm::mat4 transform_shadow = single_object->GetNodePtr()->GetTransform().GetLocalToWorldMatrix();
-            glm::mat4 inv_shadow = glm::inverse(transform_shadow);
-            Ray temp_ray_shadow = shadow_ray;
-            temp_ray_shadow.ApplyTransform(inv_shadow);
-
-            const auto& shadow_hittable = single_object->GetHittable();
-            if (shadow_hittable.Intersect(temp_ray_shadow, camera_.GetTMin(), shadow_record)) {
-              shadow_exists = true;
+bool Tracer::RenderPassWavefront(size_t sample,
+                                 const Tile& region,
+                                 std::chrono::steady_clock::time_point deadline,
+                                 AccumulationBuffer& buffer,
+                                 AovBuffer* aovs) const {
+  const std::vector<ObjectRecord>& objects = snapshot_.GetObjects();
+  size_t max_light_samples = GetMaxLightSamples();
+  size_t num_threads = std::max<size_t>(num_threads_, 1);
+  size_t batch_size = std::max(
+      kMinWavefrontBatchSize,
+      std::min(kWavefrontBatchSize,
+               kMaxShadowSlots / std::max<size_t>(max_light_samples, 1)));
+  size_t region_width = region.x1 - region.x0;
+  size_t num_pixels = region_width * (region.y1 - region.y0);
+
+  std::vector<WavefrontPath> paths;
+  RayBatch rays;
+  RayBatch reflected;
+  RayBatch next_rays;
+  HitBatch hits;
+  ShadowBatch shadows;
+  std::vector<glm::vec3> reflectances;
+  std::vector<uint8_t> continues;
+  std::vector<glm::vec3> miss_directions;
+  std::vector<float> miss_spreads;
+  std::vector<glm::vec3> miss_colors;
+  for (size_t first = 0; first < num_pixels; first += batch_size) {
+    if (deadline != std::chrono::steady_clock::time_point::max() &&
+        std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+
+    // Generate: one path per active pixel of the batch.
+    paths.clear();
+    rays.Clear();
+    size_t last = std::min(num_pixels, first + batch_size);
+    for (size_t pixel = first; pixel < last; pixel++) {
+      size_t x = region.x0 + pixel % region_width;
+      size_t y = region.y0 + pixel / region_width;
+      if (!buffer.IsActive(x, y)) {
+        continue;
+      }
+      WavefrontPath path;
+      path.color = glm::vec3(0.0f);
+      path.throughput = glm::vec3(1.0f);
+      path.x = static_cast<uint32_t>(x);
+      path.y = static_cast<uint32_t>(y);
+      path.seed = PathSeed(x, y, sample);
+      path.cone = primary_cone_;
+      rays.Push(GeneratePrimaryRay(x, y, sample),
+                static_cast<uint32_t>(paths.size()));
+      paths.push_back(path);
+    }
+
+    for (size_t depth = 0; rays.GetSize() > 0; depth++) {
+      size_t num_rays = rays.GetSize();
+      if (depth == 0) {
+        LocalRayCounts().primary += num_rays;
+      } else {
+        LocalRayCounts().reflection += num_rays;
+      }
+      ExtendRays(rays, hits);
+
+      shadows.Resize(num_rays * max_light_samples);
+      reflected.origins.resize(num_rays);
+      reflected.directions.resize(num_rays);
+      reflected.paths = rays.paths;
+      reflectances.resize(num_rays);
+      std::vector<uint32_t> order = BinHitsByObject(hits, objects.size());
+      ShadeHits(rays, order, paths, depth, hits, shadows, reflected,
+                reflectances, depth == 0 ? aovs : nullptr);
+
+      // Misses are binned last; their background lookups go in batches.
+      size_t first_miss = order.size();
+      while (first_miss > 0 &&
+             hits.objects[order[first_miss - 1]] == HitBatch::kNoHitObject) {
+        first_miss--;
+      }
+      size_t num_misses = order.size() - first_miss;
+      miss_directions.resize(num_misses);
+      miss_spreads.resize(num_misses);
+      miss_colors.resize(num_misses);
+      for (size_t k = 0; k < num_misses; k++) {
+        uint32_t i = order[first_miss + k];
+        miss_directions[k] = rays.directions[i];
+        miss_spreads[k] = paths[rays.paths[i]].cone.spread;
+      }
+      ParallelFor(num_misses, num_threads, [&](size_t begin, size_t end) {
+        GetBackgroundColors(&miss_directions[begin], &miss_spreads[begin],
+                            end - begin, &miss_colors[begin]);
+      });
+      for (size_t k = 0; k < num_misses; k++) {
+        WavefrontPath& path = paths[rays.paths[order[first_miss + k]]];
+        path.color += path.throughput * miss_colors[k];
+      }
+
+      if (shadows_enabled_) {
+        TraceShadowRays(shadows);
+      }
+
+      // Sums each hit's lighting in the order of its light samples, as
+      // ShadeHit does, and decides whether its path goes on.
+      continues.assign(num_rays, 0);
+      ParallelFor(num_rays, num_threads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          if (hits.objects[i] == HitBatch::kNoHitObject) {
+            continue;
+          }
+          WavefrontPath& path = paths[rays.paths[i]];
+          glm::vec3 I(0.0f);
+          for (size_t slot = i * max_light_samples;
+               slot < (i + 1) * max_light_samples; slot++) {
+            if (shadows.status[slot] == ShadowBatch::kVisible) {
+              I += shadows.contributions[slot];
             }
           }
+          path.color += path.throughput * I;
+          if (depth >= max_bounces_) {
+            continue;
+          }
+          path.throughput *= reflectances[i];
+          continues[i] = ContinuePath(path.throughput, depth, path.seed);
+        }
+      });
 
-          if (!shadows_enabled_ || !shadow_exists || shadow_record.time > dist_to_light) {
-            I += (I_diffuse + I_specular);
+      // Surviving paths go on with their reflected rays, sorted so that
+      // the next extend stage traverses neighbouring rays together.
+      next_rays.Clear();
+      for (size_t i = 0; i < num_rays; i++) {
+        if (continues[i]) {
+          next_rays.Push(reflected.GetRay(i), reflected.paths[i]);
+        }
+      }
+      SortRaysCoherently(next_rays);
+      rays.Swap(next_rays);
+    }
+
+    for (const WavefrontPath& path : paths) {
+      buffer.AddSample(path.x, path.y, path.color);
+    }
+    FlushLocalRayCounts();
+  }
+  return true;
+}
+
+
+void Tracer::ExtendRays(const RayBatch& rays, HitBatch& hits) const {
+  hits.Resize(rays.GetSize());
+  float t_min = camera_.GetTMin();
+  ParallelFor(rays.GetSize(), num_threads_, [&](size_t begin, size_t end) {
+    if (packets_enabled_) {
+      // Neighbours are coherent after sorting, so they go in packets.
+      for (size_t first = begin; first < end; first += kPacketSize) {
+        RayPacket packet;
+        for (int lane = 0; lane < kPacketSize && first + lane < end; lane++) {
+          packet.SetRay(lane, rays.GetRay(first + lane));
+          packet.mask |= 1u << lane;
+        }
+        HitRecord records[kPacketSize];
+        size_t object_indices[kPacketSize];
+        unsigned hit =
+            top_level_.IntersectPacket(packet, t_min, records, object_indices);
+        for (int lane = 0; lane < kPacketSize; lane++) {
+          if (hit & (1u << lane)) {
+            TRACE_STATS_INC(hits);
+            hits.records[first + lane] = records[lane];
+            hits.objects[first + lane] =
+                static_cast<uint32_t>(object_indices[lane]);
           }
         }
+      }
+    } else {
+      for (size_t i = begin; i < end; i++) {
+        size_t object_index;
+        if (top_level_.Intersect(rays.GetRay(i), t_min, hits.records[i],
+                                 object_index)) {
+          TRACE_STATS_INC(hits);
+          hits.objects[i] = static_cast<uint32_t>(object_index);
+        }
+      }
+    }
+#ifdef TRACER_STATS
+    FlushLocalTraceStats();
+#endif
+  });
+}
+
 
-        // Ambient light
-        if (single_light->GetLightPtr()->GetType() == LightType::Ambient) {
-          glm::vec3 k_ambient = single_tracing->GetNodePtr()->GetComponentPtr<MaterialComponent>()->GetMaterial().GetAmbientColor();
-          glm::vec3 L_ambient = single_light->GetLightPtr()->GetDiffuseColor();
-          glm::vec3 I_ambient = k_ambient * L_ambient;
-          I += I_ambient;
+void Tracer::ShadeHits(const RayBatch& rays,
+                       const std::vector<uint32_t>& order,
+                       std::vector<WavefrontPath>& paths,
+                       size_t depth,
+                       HitBatch& hits,
+                       ShadowBatch& shadows,
+                       RayBatch& reflected,
+                       std::vector<glm::vec3>& reflectances,
+                       AovBuffer* aovs) const {
+  const std::vector<LightRecord>& lights = snapshot_.GetLights();
+  size_t max_light_samples =
+      rays.GetSize() > 0 ? shadows.status.size() / rays.GetSize() : 0;
+  // order runs through the hits object by object, so a thread shades one
+  // material at a time.
+  ParallelFor(order.size(), num_threads_, [&](size_t begin, size_t end) {
+    for (size_t j = begin; j < end; j++) {
+      uint32_t i = order[j];
+      uint32_t object_index = hits.objects[i];
+      if (object_index == HitBatch::kNoHitObject) {
+        continue;
+      }
+      Ray ray = rays.GetRay(i);
+      HitRecord& record = hits.records[i];
+      SurfacePoint point = PrepareSurfacePoint(ray, record, object_index);
+      WavefrontPath& path = paths[rays.paths[i]];
+      if (aovs != nullptr) {
+        aovs->RecordHit(path.x, path.y, record, object_index);
+      }
+      if (TracksRayCones()) {
+        path.cone.Propagate(record.time);
+        path.cone.Reflect(GetCurvature(record, object_index));
+      }
+
+      static thread_local std::vector<LightSample> samples;
+      SelectLights(point.position, LightSeed(path.seed, depth), samples);
+      size_t slot = i * max_light_samples;
+      for (const LightSample& sample : samples) {
+        const LightRecord& light = lights[sample.light];
+        if (light.type == LightType::Ambient) {
+          shadows.contributions[slot] =
+              GetAmbientLighting(light, point) * sample.weight;
+          shadows.status[slot] = ShadowBatch::kVisible;
+          slot++;
+          continue;
+        }
+        Ray shadow_ray = ray;
+        float dist_to_light;
+        glm::vec3 contribution =
+            GetDirectLighting(light, point, shadow_ray, dist_to_light) *
+            sample.weight;
+        // Adding nothing needs no shadow ray.
+        if (contribution != glm::vec3(0.0f)) {
+          shadows.origins[slot] = shadow_ray.GetOrigin();
+          shadows.directions[slot] = shadow_ray.GetDirection();
+          shadows.distances[slot] = dist_to_light;
+          shadows.contributions[slot] = contribution;
+          shadows.status[slot] = shadows_enabled_ ? ShadowBatch::kPending
+                                                  : ShadowBatch::kVisible;
         }
+        slot++;
       }
 
-      // Secondary rays
-      if (bounces > 0) {
-        HitRecord bounce_record;
-        glm::vec3 R = ray.GetDirection() - 2 * glm::dot(ray.GetDirection(), record.normal) * record.normal;
-        glm::vec3 R_epsilon = R * glm::vec3(0.01);
-        Ray reflected(hit_pos + R_epsilon, R);
-        I_indirect = (TraceRay(reflected, bounces - 1, bounce_record) * single_tracing->GetNodePtr()->GetComponentPtr<MaterialComponent>()->GetMaterial().GetSpecularColor());
+      Ray mirror = GetReflectedRay(ray, point);
+      reflected.origins[i] = mirror.GetOrigin();
+      reflected.directions[i] = mirror.GetDirection();
+      reflectances[i] = point.material->specular_color;
+    }
+  });
+}
+
+
+void Tracer::TraceShadowRays(ShadowBatch& shadows) const {
+  std::vector<uint32_t> queue;
+  for (size_t slot = 0; slot < shadows.status.size(); slot++) {
+    if (shadows.status[slot] == ShadowBatch::kPending) {
+      queue.push_back(static_cast<uint32_t>(slot));
+    }
+  }
+  SortCoherently(shadows.origins, shadows.directions, queue);
+  LocalRayCounts().shadow += queue.size();
+
+  float t_min = camera_.GetTMin();
+  ParallelFor(queue.size(), num_threads_, [&](size_t begin, size_t end) {
+    for (size_t k = begin; k < end; k++) {
+      uint32_t slot = queue[k];
+      Ray shadow_ray(shadows.origins[slot], shadows.directions[slot]);
+      bool occluded =
+          top_level_.Occluded(shadow_ray, t_min, shadows.distances[slot]);
+      shadows.status[slot] =
+          occluded ? ShadowBatch::kOccluded : ShadowBatch::kVisible;
+    }
+#ifdef TRACER_STATS
+    FlushLocalTraceStats();
+#endif
+  });
+}
+
+
+void Tracer::RenderTile(const Tile& tile,
+                        size_t sample,
+                        AccumulationBuffer& buffer,
+                        AovBuffer* aovs) const {
+  if (packets_enabled_) {
+    RenderTilePackets(tile, sample, buffer, aovs);
+    return;
+  }
+  uint64_t num_rays = 0;
+  for (size_t y = tile.y0; y < tile.y1; y++) {
+    for (size_t x = tile.x0; x < tile.x1; x++) {
+      if (!buffer.IsActive(x, y)) {
+        continue;
+      }
+      num_rays++;
+#ifdef TRACER_STATS
+      uint64_t cost = LocalTraceStats().GetTraversalCost();
+#endif
+      Ray ray = GeneratePrimaryRay(x, y, sample);
+      HitRecord record;
+      size_t object_index = kNoObject;
+      glm::vec3 color = TraceRay(ray, max_bounces_, PathSeed(x, y, sample),
+                                 record, &object_index);
+      buffer.AddSample(x, y, color);
+      if (aovs != nullptr && object_index != kNoObject) {
+        aovs->RecordHit(x, y, record, object_index);
+      }
+#ifdef TRACER_STATS
+      if (aovs != nullptr) {
+        aovs->AddCost(x, y, LocalTraceStats().GetTraversalCost() - cost);
       }
+#endif
+    }
+  }
+  LocalRayCounts().primary += num_rays;
+}
+
 
-      pixel_color = I + I_indirect;
+void Tracer::RenderTilePackets(const Tile& tile,
+                               size_t sample,
+                               AccumulationBuffer& buffer,
+                               AovBuffer* aovs) const {
+  uint64_t num_rays = 0;
+  for (size_t y0 = tile.y0; y0 < tile.y1; y0 += kPacketWidth) {
+    for (size_t x0 = tile.x0; x0 < tile.x1; x0 += kPacketWidth) {
+      RayPacket packet;
+      for (int lane = 0; lane < kPacketSize; lane++) {
+        size_t x = x0 + lane % kPacketWidth;
+        size_t y = y0 + lane / kPacketWidth;
+        if (x < tile.x1 && y < tile.y1 && buffer.IsActive(x, y)) {
+          packet.SetRay(lane, GeneratePrimaryRay(x, y, sample));
+          packet.mask |= 1u << lane;
+          num_rays++;
+        }
+      }
+
+      if (packet.mask == 0) {
+        continue;
+      }
+      HitRecord records[kPacketSize];
+      size_t object_indices[kPacketSize];
+#ifdef TRACER_STATS
+      // The packet's traversal is shared evenly by its rays.
+      uint64_t cost = LocalTraceStats().GetTraversalCost();
+#endif
+      unsigned hit = top_level_.IntersectPacket(packet, camera_.GetTMin(),
+                                                records, object_indices);
+#ifdef TRACER_STATS
+      float packet_cost = float(LocalTraceStats().GetTraversalCost() - cost);
+      int num_lanes = 0;
+      for (int lane = 0; lane < kPacketSize; lane++) {
+        num_lanes += (packet.mask >> lane) & 1;
+        TRACE_STATS_ADD(hits, (hit >> lane) & 1);
+      }
+      float lane_cost = packet_cost / num_lanes;
+#endif
+      glm::vec3 miss_directions[kPacketSize];
+      float miss_spreads[kPacketSize];
+      glm::vec3 miss_colors[kPacketSize];
+      int num_misses = 0;
+      for (int lane = 0; lane < kPacketSize; lane++) {
+        if ((packet.mask & ~hit) & (1u << lane)) {
+          miss_directions[num_misses] = packet.directions[lane];
+          miss_spreads[num_misses] = primary_cone_.spread;
+          num_misses++;
+        }
+      }
+      GetBackgroundColors(miss_directions, miss_spreads, num_misses,
+                          miss_colors);
+      num_misses = 0;
+      // Shading and secondary rays go one ray at a time.
+      for (int lane = 0; lane < kPacketSize; lane++) {
+        if (!(packet.mask & (1u << lane))) {
+          continue;
+        }
+        Ray ray = packet.GetRay(lane);
+        size_t x = x0 + lane % kPacketWidth;
+        size_t y = y0 + lane / kPacketWidth;
+#ifdef TRACER_STATS
+        cost = LocalTraceStats().GetTraversalCost();
+#endif
+        glm::vec3 color =
+            (hit & (1u << lane))
+                ? TracePath(ray, max_bounces_, PathSeed(x, y, sample),
+                            records[lane], object_indices[lane])
+                : miss_colors[num_misses++];
+        buffer.AddSample(x, y, color);
+        if (aovs != nullptr && (hit & (1u << lane))) {
+          aovs->RecordHit(x, y, records[lane], object_indices[lane]);
+        }
+#ifdef TRACER_STATS
+        if (aovs != nullptr) {
+          aovs->AddCost(x, y,
+                        lane_cost + float(LocalTraceStats().GetTraversalCost() -
+                                          cost));
+        }
+#endif
+      }
     }
   }
+  LocalRayCounts().primary += num_rays;
+}
+
+
+Ray Tracer::GeneratePrimaryRay(size_t x, size_t y, size_t sample) const {
+  glm::vec2 offset(0.0f);
+  if (sampling_.jitter) {
+    // Each round of 4^strata_levels_ samples visits every stratum once;
+    // see ProgressiveStratum for the order.
+    uint32_t num_strata = 1u << (2 * strata_levels_);
+    uint32_t round = static_cast<uint32_t>(sample / num_strata);
+    glm::uvec2 stratum = ProgressiveStratum(
+        static_cast<uint32_t>(sample % num_strata), strata_levels_,
+        HashUint(x + HashUint(y + HashUint(round))));
+    float strata_per_axis = float(1u << strata_levels_);
+    offset.x = (stratum.x + SampleRandom(x, y, sample, 0)) / strata_per_axis;
+    offset.y = (stratum.y + SampleRandom(x, y, sample, 1)) / strata_per_axis;
+  } else if (sample > 0) {
+    offset.x = SampleRandom(x, y, sample, 0);
+    offset.y = SampleRandom(x, y, sample, 1);
+  }
+  float x_norm = (float(x) + offset.x) / image_size_.x * 2 - 1;
+  float y_norm = (float(y) + offset.y) / image_size_.y * 2 - 1;
+  return camera_.GenerateRay(glm::vec2(x_norm, y_norm));
+}
 
-  // if (record.time < std::numeric_limits<float>::max()) {
-  //   return pixel_color;
-  // } else {
-  //   return GetBackgroundColor(ray.GetDirection());
-  // }
 
-  if (hit) {
-    return pixel_color;
+glm::vec3 Tracer::TraceRay(const Ray& ray,
+                           size_t bounces,
+                           uint32_t path_seed,
+                           HitRecord& record,
+                           size_t* hit_object) const {
+  size_t object_index;
+  if (top_level_.Intersect(ray, camera_.GetTMin(), record, object_index)) {
+    TRACE_STATS_INC(hits);
+    if (hit_object != nullptr) {
+      *hit_object = object_index;
+    }
+    return TracePath(ray, bounces, path_seed, record, object_index);
   } else {
-    return GetBackgroundColor(ray.GetDirection());
+    return GetBackgroundColor(ray.GetDirection(), primary_cone_.spread);
+  }
+}
+
+
+glm::vec3 Tracer::TracePath(const Ray& ray,
+                            size_t bounces,
+                            uint32_t path_seed,
+                            HitRecord& record,
+                            size_t object_index) const {
+  // A hit spawns at most one reflected ray, so the path is a chain and
+  // each vertex adds its direct lighting weighted by the product of the
+  // specular colors before it.
+  glm::vec3 color(0.0f);
+  glm::vec3 throughput(1.0f);
+  Ray current = ray;
+  RayCone cone = primary_cone_;
+  HitRecord* hit = &record;
+  HitRecord bounce_record;
+  uint64_t num_rays = 0;
+  for (size_t depth = 0;; depth++) {
+    Ray reflected = current;
+    glm::vec3 reflectance;
+    color += throughput * ShadeHit(current, *hit, object_index,
+                                   LightSeed(path_seed, depth), reflected,
+                                   reflectance);
+    if (depth >= bounces) {
+      break;
+    }
+    throughput *= reflectance;
+    if (!ContinuePath(throughput, depth, path_seed)) {
+      break;
+    }
+    if (TracksRayCones()) {
+      cone.Propagate(hit->time);
+      cone.Reflect(GetCurvature(*hit, object_index));
+    }
+
+    bounce_record = HitRecord();
+    hit = &bounce_record;
+    num_rays++;
+    if (!top_level_.Intersect(reflected, camera_.GetTMin(), bounce_record,
+                              object_index)) {
+      color += throughput *
+               GetBackgroundColor(reflected.GetDirection(), cone.spread);
+      break;
+    }
+    TRACE_STATS_INC(hits);
+    current = reflected;
   }
+  LocalRayCounts().reflection += num_rays;
+  return color;
+}
+
+
+bool Tracer::ContinuePath(glm::vec3& throughput,
+                          size_t depth,
+                          uint32_t path_seed) const {
+  float max_throughput =
+      std::max(throughput.x, std::max(throughput.y, throughput.z));
+  if (max_throughput <= sampling_.min_throughput) {
+    return false;
+  }
+  if (sampling_.roulette_depth > 0 &&
+      depth + 1 >= sampling_.roulette_depth && max_throughput < 1.0f) {
+    // Survivors are reweighted so the expected contribution is unchanged.
+    float random = ToUnitFloat(HashUint(path_seed + uint32_t(depth)));
+    if (random >= max_throughput) {
+      return false;
+    }
+    throughput /= max_throughput;
+  }
+  return true;
+}
+
+
+glm::vec3 Tracer::ShadeHit(const Ray& ray,
+                           HitRecord& record,
+                           size_t object_index,
+                           uint32_t light_seed,
+                           Ray& reflected,
+                           glm::vec3& reflectance) const {
+  SurfacePoint point = PrepareSurfacePoint(ray, record, object_index);
+  glm::vec3 I(0.0f);
+
+  const std::vector<LightRecord>& lights = snapshot_.GetLights();
+  static thread_local std::vector<LightSample> samples;
+  SelectLights(point.position, light_seed, samples);
+  uint64_t num_shadow_rays = 0;
+  for (const LightSample& sample : samples) {
+    const LightRecord& light = lights[sample.light];
+    // Point light & directional light
+    if (light.type == LightType::Point || light.type == LightType::Directional) {
+      Ray shadow_ray = ray;
+      float dist_to_light;
+      glm::vec3 I_direct =
+          GetDirectLighting(light, point, shadow_ray, dist_to_light) *
+          sample.weight;
+      // Adding nothing needs no shadow ray.
+      if (I_direct == glm::vec3(0.0f)) {
+        continue;
+      }
+
+      // Check shadow; any blocker closer than the light will do.
+      bool shadow_exists = false;
+      if (shadows_enabled_) {
+        num_shadow_rays++;
+        shadow_exists = top_level_.Occluded(shadow_ray, camera_.GetTMin(), dist_to_light);
+      }
+
+      if (!shadow_exists) {
+        I += I_direct;
+      }
+    }
+
+    // Ambient light
+    if (light.type == LightType::Ambient) {
+      I += GetAmbientLighting(light, point) * sample.weight;
+    }
+  }
+
+  LocalRayCounts().shadow += num_shadow_rays;
+  reflected = GetReflectedRay(ray, point);
+  reflectance = point.material->specular_color;
+  return I;
+}
+
+
+void Tracer::SelectLights(const glm::vec3& position,
+                          uint32_t light_seed,
+                          std::vector<LightSample>& samples) const {
+  const std::vector<LightRecord>& lights = snapshot_.GetLights();
+  samples.clear();
+  if (!light_bvh_.IsCulling() && sampling_.light_samples == 0) {
+    for (size_t i = 0; i < lights.size(); i++) {
+      samples.push_back({static_cast<uint32_t>(i), 1.0f});
+    }
+    return;
+  }
+
+  static thread_local std::vector<uint32_t> candidates;
+  light_bvh_.Query(position, candidates);
+  if (sampling_.light_samples == 0) {
+    for (uint32_t i : candidates) {
+      samples.push_back({i, 1.0f});
+    }
+    return;
+  }
+
+  // Point lights are drawn with replacement in proportion to their
+  // brightest unshadowed channel here, and reweighted by the inverse of
+  // their expected number of draws.
+  static thread_local std::vector<uint32_t> point_lights;
+  static thread_local std::vector<float> cdf;
+  point_lights.clear();
+  cdf.clear();
+  float total = 0.0f;
+  for (uint32_t i : candidates) {
+    const LightRecord& light = lights[i];
+    if (light.type != LightType::Point) {
+      samples.push_back({i, 1.0f});
+      continue;
+    }
+    glm::vec3 dir_to_light;
+    glm::vec3 intensity;
+    float dist_to_light;
+    Illuminator::GetIllumination(light, position, dir_to_light, intensity,
+                                 dist_to_light);
+    float estimate =
+        std::max(intensity.x, std::max(intensity.y, intensity.z));
+    if (estimate > 0.0f && std::isfinite(estimate)) {
+      total += estimate;
+      point_lights.push_back(i);
+      cdf.push_back(total);
+    }
+  }
+  if (point_lights.empty()) {
+    return;
+  }
+  size_t num_draws = sampling_.light_samples;
+  for (size_t k = 0; k < num_draws; k++) {
+    float target = ToUnitFloat(HashUint(light_seed + uint32_t(k))) * total;
+    size_t j = std::upper_bound(cdf.begin(), cdf.end(), target) - cdf.begin();
+    j = std::min(j, point_lights.size() - 1);
+    float estimate = cdf[j] - (j > 0 ? cdf[j - 1] : 0.0f);
+    if (estimate > 0.0f) {
+      samples.push_back({point_lights[j], total / (estimate * num_draws)});
+    }
+  }
+}
+
+
+size_t Tracer::GetMaxLightSamples() const {
+  const std::vector<LightRecord>& lights = snapshot_.GetLights();
+  if (sampling_.light_samples == 0) {
+    return lights.size();
+  }
+  size_t num_other_lights = 0;
+  for (auto& light : lights) {
+    if (light.type != LightType::Point) {
+      num_other_lights++;
+    }
+  }
+  return num_other_lights + sampling_.light_samples;
+}
+
+
+Tracer::SurfacePoint Tracer::PrepareSurfacePoint(const Ray& ray,
+                                                 HitRecord& record,
+                                                 size_t object_index) const {
+  const ObjectRecord& object = snapshot_.GetObjects()[object_index];
+  Ray temp_ray = ray;
+  temp_ray.ApplyTransform(object.world_to_local);
+
+  record.normal = glm::normalize(object.normal_matrix * record.normal);
+
+  temp_ray.ApplyTransform(object.local_to_world);
+  SurfacePoint point;
+  point.position = temp_ray.At(record.time);
+  point.normal = record.normal;
+  point.surface_to_eye = temp_ray.GetDirection();
+  point.material = &object.material;
+  return point;
+}
+
+
+glm::vec3 Tracer::GetDirectLighting(const LightRecord& light,
+                                    const SurfacePoint& point,
+                                    Ray& shadow_ray,
+                                    float& dist_to_light) const {
+  // Diffuse shading
+  glm::vec3 dir_to_light(0.0f);
+  glm::vec3 intensity(0.0f);
+  dist_to_light = 0.0f;
+  Illuminator::GetIllumination(light, point.position, dir_to_light, intensity, dist_to_light);
+  glm::vec3 normal = point.normal;
+  glm::vec3 k_diffuse = point.material->diffuse_color;
+  glm::vec3 I_diffuse = GetDiffuseShading(dir_to_light, normal, intensity, k_diffuse);
+
+  // Specular shading
+  glm::vec3 surface_to_eye = point.surface_to_eye;
+  glm::vec3 k_specular = point.material->specular_color;
+  float shininess = point.material->shininess;
+  glm::vec3 I_specular = GetSpecularShading(shininess, dir_to_light, surface_to_eye, normal, intensity, k_specular);
+
+  glm::vec3 light_dir_epsilon = dir_to_light * glm::vec3(0.01);
+  shadow_ray = Ray(point.position + light_dir_epsilon, dir_to_light);
+  return I_diffuse + I_specular;
+}
+
+
+glm::vec3 Tracer::GetAmbientLighting(const LightRecord& light,
+                                     const SurfacePoint& point) const {
+  glm::vec3 k_ambient = point.material->ambient_color;
+  glm::vec3 L_ambient = light.color;
+  return k_ambient * L_ambient;
+}
+
+
+Ray Tracer::GetReflectedRay(const Ray& ray, const SurfacePoint& point) const {
+  glm::vec3 R = ray.GetDirection() - 2 * glm::dot(ray.GetDirection(), point.normal) * point.normal;
+  glm::vec3 R_epsilon = R * glm::vec3(0.01);
+  return Ray(point.position + R_epsilon, R);
 }
 
 
@@ -167,15 +1056,45 @@ glm::vec3 Tracer::GetSpecularShading(float shininess,
   
   glm::vec3 reflected_eye = surface_to_eye - 2 * glm::dot(surface_to_eye, normal) * normal;
   float clamped = std::max(0.0f, glm::dot(light_dir, reflected_eye));
-  glm::vec3 I_specular = pow(clamped, shininess) * intensity * k_specular;
+  glm::vec3 I_specular = std::pow(clamped, shininess) * intensity * k_specular;
   return I_specular;
 }
 
 
-glm::vec3 Tracer::GetBackgroundColor(const glm::vec3& direction) const {
+float Tracer::GetCurvature(const HitRecord& record,
+                          size_t object_index) const {
+  const ObjectRecord& object = snapshot_.GetObjects()[object_index];
+  return object.hittable->GetCurvature(record) / object.scale;
+}
+
+
+glm::vec3 Tracer::GetBackgroundColor(const glm::vec3& direction,
+                                     float spread) const {
   if (cube_map_ != nullptr) {
-    return cube_map_->GetTexel(direction);
+    float lod = sampling_.cube_map_lod ? cube_map_->GetLod(spread) : 0.0f;
+    return cube_map_->GetTexel(direction, lod);
   } else
     return background_color_;
 }
+
+
+void Tracer::GetBackgroundColors(const glm::vec3* directions,
+                                 const float* spreads,
+                                 size_t count,
+                                 glm::vec3* colors) const {
+  if (cube_map_ == nullptr) {
+    std::fill(colors, colors + count, background_color_);
+    return;
+  }
+  const size_t kBatchSize = 64;
+  float lods[kBatchSize];
+  for (size_t first = 0; first < count; first += kBatchSize) {
+    size_t size = std::min(kBatchSize, count - first);
+    for (size_t i = 0; i < size; i++) {
+      lods[i] = sampling_.cube_map_lod ? cube_map_->GetLod(spreads[first + i])
+                                       : 0.0f;
+    }
+    cube_map_->GetTexels(directions + first, lods, size, colors + first);
+  }
+}
 }  // namespace GLOO
@@ -1,7 +1,10 @@
 #ifndef TRACER_H_
 #define TRACER_H_
 
+#include <chrono>
+
 #include "gloo/Scene.hpp"
+#include "gloo/Image.hpp"
 #include "gloo/Material.hpp"
 #include "gloo/lights/LightBase.hpp"
 #include "gloo/components/LightComponent.hpp"
@@ -11,6 +14,15 @@
 #include "TracingComponent.hpp"
 #include "CubeMap.hpp"
 #include "PerspectiveCamera.hpp"
+#include "TileQueue.hpp"
+#include "TopLevelAccel.hpp"
+#include "RenderSnapshot.hpp"
+#include "SamplingSpec.hpp"
+#include "AccumulationBuffer.hpp"
+#include "AovBuffer.hpp"
+#include "LightBVH.hpp"
+#include "RayCone.hpp"
+#include "Wavefront.hpp"
 
 namespace GLOO {
 class Tracer {
@@ -20,21 +32,179 @@ class Tracer {
          size_t max_bounces,
          const glm::vec3& background_color,
          const CubeMap* cube_map,
-         bool shadows_enabled)
+         bool shadows_enabled,
+         size_t num_threads,
+         bool packets_enabled,
+         bool wavefront_enabled,
+         const SamplingSpec& sampling)
       : camera_(camera_spec),
         image_size_(image_size),
         max_bounces_(max_bounces),
         background_color_(background_color),
         cube_map_(cube_map),
         shadows_enabled_(shadows_enabled),
+        num_threads_(num_threads),
+        packets_enabled_(packets_enabled),
+        wavefront_enabled_(wavefront_enabled),
+        sampling_(sampling),
         scene_ptr_(nullptr) {
   }
-  void Render(const Scene& scene, const std::string& output_file);
+  // Renders progressively, one sample per pixel per pass, until
+  // sampling's sample count or time budget is reached. The output file
+  // is only ever replaced by a complete image. The AOVs in aov_outputs
+  // come from the first sample's primary hits.
+  void Render(const Scene& scene,
+              const std::string& output_file,
+              const AovOutputs& aov_outputs = AovOutputs());
+  // Renders all samples of one band of rows at a time, from the top, and
+  // streams each finished band to output_file, so that memory use does
+  // not grow with the image. Adaptive sampling looks at one band at a
+  // time; the filter, time budgets and snapshots are not supported.
+  void RenderStreaming(const Scene& scene, const std::string& output_file);
+  // Renders only the pixels of region, which must lie in the image, and
+  // writes their samples to the tile file output_file (see TileFile.hpp)
+  // for merging with the other regions of the image. Needs a fixed number
+  // of samples per pixel: no adaptive sampling, time budget or snapshots.
+  void RenderRegion(const Scene& scene,
+                    const Tile& region,
+                    const std::string& output_file);
 
  private:
-  glm::vec3 TraceRay(const Ray& ray, size_t bounces, HitRecord& record) const;
+  // Compiles scene for tracing and sets up the sampling; returns the
+  // number of samples per pixel.
+  size_t PrepareRender(const Scene& scene);
+  // Adds num_samples samples to every pixel of region in buffer, or
+  // fewer where adaptive sampling stops them.
+  void AccumulateRegion(const Tile& region,
+                        size_t num_samples,
+                        AccumulationBuffer& buffer) const;
+  // Adds sample number `sample` to every pixel of region in buffer,
+  // stopping early if deadline passes, and records the primary hits in
+  // aovs if it is not null. Returns false if it stopped early.
+  bool RenderPass(size_t sample,
+                  const Tile& region,
+                  std::chrono::steady_clock::time_point deadline,
+                  AccumulationBuffer& buffer,
+                  AovBuffer* aovs) const;
+  // RenderPass for the wavefront engine: instead of following one path
+  // at a time, each stage runs over a whole batch of paths before the
+  // next one starts. Gives the same image as RenderPass.
+  bool RenderPassWavefront(size_t sample,
+                           const Tile& region,
+                           std::chrono::steady_clock::time_point deadline,
+                           AccumulationBuffer& buffer,
+                           AovBuffer* aovs) const;
+  // Extend stage: finds the closest hit of every ray.
+  void ExtendRays(const RayBatch& rays, HitBatch& hits) const;
+  // Shade stage: prepares the hits in order, shading them grouped by
+  // object, fills their light slots and their reflected rays, and
+  // records them in aovs if it is not null.
+  void ShadeHits(const RayBatch& rays,
+                 const std::vector<uint32_t>& order,
+                 std::vector<WavefrontPath>& paths,
+                 size_t depth,
+                 HitBatch& hits,
+                 ShadowBatch& shadows,
+                 RayBatch& reflected,
+                 std::vector<glm::vec3>& reflectances,
+                 AovBuffer* aovs) const;
+  // Shadow stage: resolves the pending slots of shadows.
+  void TraceShadowRays(ShadowBatch& shadows) const;
+  void RenderTile(const Tile& tile,
+                  size_t sample,
+                  AccumulationBuffer& buffer,
+                  AovBuffer* aovs) const;
+  // Traces the tile's primary rays in kPacketWidth x kPacketWidth packets.
+  void RenderTilePackets(const Tile& tile,
+                         size_t sample,
+                         AccumulationBuffer& buffer,
+                         AovBuffer* aovs) const;
+  // With jittering, samples go through random points of the pixel's
+  // strata; otherwise sample 0 goes through the pixel's corner and later
+  // ones through uniformly random points of the pixel.
+  Ray GeneratePrimaryRay(size_t x, size_t y, size_t sample) const;
+  // Color seen along ray, following at most `bounces` reflections.
+  // path_seed drives Russian roulette. Sets *hit_object, if given, to the
+  // index of the object hit first and leaves it untouched on a miss.
+  glm::vec3 TraceRay(const Ray& ray,
+                     size_t bounces,
+                     uint32_t path_seed,
+                     HitRecord& record,
+                     size_t* hit_object = nullptr) const;
+  // Same as TraceRay for a ray whose first hit, on object object_index,
+  // is already in record. Reflections are followed in a loop that stops
+  // early once the path's throughput is at most
+  // sampling_.min_throughput, or by Russian roulette.
+  glm::vec3 TracePath(const Ray& ray,
+                      size_t bounces,
+                      uint32_t path_seed,
+                      HitRecord& record,
+                      size_t object_index) const;
+  // Applies the throughput cutoff and Russian roulette after bounce
+  // `depth` to a path whose throughput already includes the new bounce.
+  // Returns false if the path stops.
+  bool ContinuePath(glm::vec3& throughput,
+                    size_t depth,
+                    uint32_t path_seed) const;
+  // Direct lighting at the hit in record on object object_index, which
+  // also gets its world-space normal. light_seed drives light sampling.
+  // Sets reflected to the mirror ray and reflectance to the weight of the
+  // color seen along it.
+  glm::vec3 ShadeHit(const Ray& ray,
+                     HitRecord& record,
+                     size_t object_index,
+                     uint32_t light_seed,
+                     Ray& reflected,
+                     glm::vec3& reflectance) const;
+
+  // A ray's hit on a surface, in world space, ready for lighting.
+  struct SurfacePoint {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec3 surface_to_eye;
+    const MaterialRecord* material;
+  };
+  // Also turns record's normal into the world-space normal.
+  SurfacePoint PrepareSurfacePoint(const Ray& ray,
+                                   HitRecord& record,
+                                   size_t object_index) const;
+  // A light to shade a point with, its contribution scaled by weight.
+  struct LightSample {
+    uint32_t light;
+    float weight;
+  };
+  // The lights that shade position, in the order their contributions
+  // are summed: with neither culling nor light sampling, every light in
+  // scene order with weight 1.
+  void SelectLights(const glm::vec3& position,
+                    uint32_t light_seed,
+                    std::vector<LightSample>& samples) const;
+  // Most samples SelectLights returns for any point.
+  size_t GetMaxLightSamples() const;
+  // Unshadowed diffuse and specular light from a point or directional
+  // light; sets the shadow ray towards it and the distance to it.
+  glm::vec3 GetDirectLighting(const LightRecord& light,
+                              const SurfacePoint& point,
+                              Ray& shadow_ray,
+                              float& dist_to_light) const;
+  glm::vec3 GetAmbientLighting(const LightRecord& light,
+                               const SurfacePoint& point) const;
+  Ray GetReflectedRay(const Ray& ray, const SurfacePoint& point) const;
 
-  glm::vec3 GetBackgroundColor(const glm::vec3& direction) const;
+  // Whether paths track their footprint, for cube map filtering.
+  bool TracksRayCones() const {
+    return cube_map_ != nullptr && sampling_.cube_map_lod;
+  }
+  // Curvature at the hit in record on object object_index, in world units.
+  float GetCurvature(const HitRecord& record, size_t object_index) const;
+  // Background seen along direction by a ray with cone spread `spread`.
+  glm::vec3 GetBackgroundColor(const glm::vec3& direction,
+                               float spread) const;
+  // GetBackgroundColor for count rays at once.
+  void GetBackgroundColors(const glm::vec3* directions,
+                           const float* spreads,
+                           size_t count,
+                           glm::vec3* colors) const;
 
   glm::vec3 GetDiffuseShading(glm::vec3& light_dir, glm::vec3& normal, glm::vec3& intensity, glm::vec3& k_diffuse) const;
   glm::vec3 GetSpecularShading(float shininess, glm::vec3& light_dir, glm::vec3& normal, glm::vec3& surface_to_eye, glm::vec3& intensity, glm::vec3& k_specular) const;
@@ -43,11 +213,21 @@ class Tracer {
   glm::ivec2 image_size_;
   size_t max_bounces_;
 
-  std::vector<TracingComponent*> tracing_components_;
-  std::vector<LightComponent*> light_components_;
+  RenderSnapshot snapshot_;
+  TopLevelAccel top_level_;
   glm::vec3 background_color_;
   const CubeMap* cube_map_;
   bool shadows_enabled_;
+  size_t num_threads_;
+  bool packets_enabled_;
+  bool wavefront_enabled_;
+  SamplingSpec sampling_;
+  LightBVH light_bvh_;
+  // Jittered samples are stratified over a 2^strata_levels_ square grid,
+  // the smallest of these with at least one stratum per sample.
+  uint32_t strata_levels_ = 0;
+  // Footprint of a primary ray.
+  RayCone primary_cone_;
 
   const Scene* scene_ptr_;
 };
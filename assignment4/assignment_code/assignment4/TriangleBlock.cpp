@@ -0,0 +1,33 @@
+#include "TriangleBlock.hpp"
+
+#include <algorithm>
+
+#include "hittable/Mesh.hpp"
+
+namespace GLOO {
+void AppendTriangleBlocks(const Mesh& mesh,
+                          const uint32_t* triangles,
+                          size_t count,
+                          std::vector<TriangleBlock>& blocks) {
+  for (size_t first = 0; first < count; first += kTriangleBlockWidth) {
+    blocks.emplace_back();
+    TriangleBlock& block = blocks.back();
+    for (int lane = 0; lane < kTriangleBlockWidth; lane++) {
+      glm::vec3 p0(0.0f), e1(0.0f), e2(0.0f);
+      uint32_t id = kNoTriangle;
+      if (first + lane < count && triangles[first + lane] != kNoTriangle) {
+        id = triangles[first + lane];
+        p0 = mesh.GetPosition(id, 0);
+        e1 = mesh.GetPosition(id, 1) - p0;
+        e2 = mesh.GetPosition(id, 2) - p0;
+      }
+      for (int dim = 0; dim < 3; dim++) {
+        block.p0[dim][lane] = p0[dim];
+        block.e1[dim][lane] = e1[dim];
+        block.e2[dim][lane] = e2[dim];
+      }
+      block.ids[lane] = id;
+    }
+  }
+}
+}  // namespace GLOO
@@ -0,0 +1,309 @@
+#ifndef TRIANGLE_BLOCK_H_
+#define TRIANGLE_BLOCK_H_
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// The kernel width follows the instruction set the file is compiled for:
+// 8 lanes with AVX, 4 with SSE2, and a plain loop over 4 lanes elsewhere.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TRIANGLE_BLOCK_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRIANGLE_BLOCK_SSE
+#endif
+
+namespace GLOO {
+class Mesh;
+
+#ifdef TRIANGLE_BLOCK_AVX
+const int kTriangleBlockWidth = 8;
+#else
+const int kTriangleBlockWidth = 4;
+#endif
+
+// Lanes of a block that hold no triangle carry this id and zero edges,
+// which the kernel always rejects.
+const uint32_t kNoTriangle = 0xffffffff;
+const unsigned kAllTriangleLanes = (1u << kTriangleBlockWidth) - 1;
+
+// Up to kTriangleBlockWidth triangles in structure-of-arrays form, so the
+// kernel loads each coordinate of all lanes with one instruction. Each
+// triangle is stored as its first vertex and the two edges leaving it.
+struct TriangleBlock {
+  float p0[3][kTriangleBlockWidth];
+  float e1[3][kTriangleBlockWidth];
+  float e2[3][kTriangleBlockWidth];
+  uint32_t ids[kTriangleBlockWidth];
+};
+
+// Appends blocks holding the given triangles of mesh, kTriangleBlockWidth
+// at a time; the last block is padded with empty lanes. kNoTriangle
+// entries in triangles become empty lanes too.
+void AppendTriangleBlocks(const Mesh& mesh,
+                          const uint32_t* triangles,
+                          size_t count,
+                          std::vector<TriangleBlock>& blocks);
+
+namespace simd {
+#if defined(TRIANGLE_BLOCK_AVX)
+typedef __m256 Lanes;
+inline Lanes Load(const float* p) {
+  return _mm256_loadu_ps(p);
+}
+inline Lanes Splat(float v) {
+  return _mm256_set1_ps(v);
+}
+inline Lanes Add(Lanes a, Lanes b) {
+  return _mm256_add_ps(a, b);
+}
+inline Lanes Sub(Lanes a, Lanes b) {
+  return _mm256_sub_ps(a, b);
+}
+inline Lanes Mul(Lanes a, Lanes b) {
+  return _mm256_mul_ps(a, b);
+}
+inline Lanes Div(Lanes a, Lanes b) {
+  return _mm256_div_ps(a, b);
+}
+inline Lanes Sqrt(Lanes a) {
+  return _mm256_sqrt_ps(a);
+}
+inline Lanes CmpGe(Lanes a, Lanes b) {
+  return _mm256_cmp_ps(a, b, _CMP_GE_OQ);
+}
+inline Lanes CmpLe(Lanes a, Lanes b) {
+  return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+}
+inline Lanes CmpLt(Lanes a, Lanes b) {
+  return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+}
+inline Lanes CmpNe(Lanes a, Lanes b) {
+  return _mm256_cmp_ps(a, b, _CMP_NEQ_OQ);
+}
+inline Lanes And(Lanes a, Lanes b) {
+  return _mm256_and_ps(a, b);
+}
+// Lanes of a where mask is set, of b elsewhere.
+inline Lanes Select(Lanes mask, Lanes a, Lanes b) {
+  return _mm256_blendv_ps(b, a, mask);
+}
+inline unsigned MoveMask(Lanes a) {
+  return static_cast<unsigned>(_mm256_movemask_ps(a));
+}
+inline void Store(float* p, Lanes a) {
+  _mm256_storeu_ps(p, a);
+}
+#elif defined(TRIANGLE_BLOCK_SSE)
+typedef __m128 Lanes;
+inline Lanes Load(const float* p) {
+  return _mm_loadu_ps(p);
+}
+inline Lanes Splat(float v) {
+  return _mm_set1_ps(v);
+}
+inline Lanes Add(Lanes a, Lanes b) {
+  return _mm_add_ps(a, b);
+}
+inline Lanes Sub(Lanes a, Lanes b) {
+  return _mm_sub_ps(a, b);
+}
+inline Lanes Mul(Lanes a, Lanes b) {
+  return _mm_mul_ps(a, b);
+}
+inline Lanes Div(Lanes a, Lanes b) {
+  return _mm_div_ps(a, b);
+}
+inline Lanes Sqrt(Lanes a) {
+  return _mm_sqrt_ps(a);
+}
+inline Lanes CmpGe(Lanes a, Lanes b) {
+  return _mm_cmpge_ps(a, b);
+}
+inline Lanes CmpLe(Lanes a, Lanes b) {
+  return _mm_cmple_ps(a, b);
+}
+inline Lanes CmpLt(Lanes a, Lanes b) {
+  return _mm_cmplt_ps(a, b);
+}
+inline Lanes CmpNe(Lanes a, Lanes b) {
+  // cmpneq is true for NaN; ordered-and-not-equal matches the AVX path.
+  return _mm_and_ps(_mm_cmpneq_ps(a, b), _mm_cmpord_ps(a, b));
+}
+inline Lanes And(Lanes a, Lanes b) {
+  return _mm_and_ps(a, b);
+}
+inline Lanes Select(Lanes mask, Lanes a, Lanes b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+inline unsigned MoveMask(Lanes a) {
+  return static_cast<unsigned>(_mm_movemask_ps(a));
+}
+inline void Store(float* p, Lanes a) {
+  _mm_storeu_ps(p, a);
+}
+#else
+// Scalar fallback with the same interface; comparisons produce 0 or 1.
+struct Lanes {
+  float v[kTriangleBlockWidth];
+};
+#define TRIANGLE_BLOCK_LANEWISE(expr)         \
+  Lanes r;                                    \
+  for (int i = 0; i < kTriangleBlockWidth; i++) \
+    r.v[i] = (expr);                          \
+  return r
+inline Lanes Load(const float* p) {
+  TRIANGLE_BLOCK_LANEWISE(p[i]);
+}
+inline Lanes Splat(float v) {
+  TRIANGLE_BLOCK_LANEWISE(v);
+}
+inline Lanes Add(Lanes a, Lanes b) {
+  TRIANGLE_BLOCK_LANEWISE(a.v[i] + b.v[i]);
+}
+inline Lanes Sub(Lanes a, Lanes b) {
+  TRIANGLE_BLOCK_LANEWISE(a.v[i] - b.v[i]);
+}
+inline Lanes Mul(Lanes a, Lanes b) {
+  TRIANGLE_BLOCK_LANEWISE(a.v[i] * b.v[i]);
+}
+inline Lanes Div(Lanes a, Lanes b) {
+  TRIANGLE_BLOCK_LANEWISE(a.v[i] / b.v[i]);
+}
+inline Lanes Sqrt(Lanes a) {
+  TRIANGLE_BLOCK_LANEWISE(std::sqrt(a.v[i]));
+}
+inline Lanes CmpGe(Lanes a, Lanes b) {
+  TRIANGLE_BLOCK_LANEWISE(a.v[i] >= b.v[i] ? 1.0f : 0.0f);
+}
+inline Lanes CmpLe(Lanes a, Lanes b) {
+  TRIANGLE_BLOCK_LANEWISE(a.v[i] <= b.v[i] ? 1.0f : 0.0f);
+}
+inline Lanes CmpLt(Lanes a, Lanes b) {
+  TRIANGLE_BLOCK_LANEWISE(a.v[i] < b.v[i] ? 1.0f : 0.0f);
+}
+inline Lanes CmpNe(Lanes a, Lanes b) {
+  TRIANGLE_BLOCK_LANEWISE(a.v[i] < b.v[i] || a.v[i] > b.v[i] ? 1.0f : 0.0f);
+}
+inline Lanes And(Lanes a, Lanes b) {
+  TRIANGLE_BLOCK_LANEWISE(a.v[i] != 0.0f && b.v[i] != 0.0f ? 1.0f : 0.0f);
+}
+inline Lanes Select(Lanes mask, Lanes a, Lanes b) {
+  TRIANGLE_BLOCK_LANEWISE(mask.v[i] != 0.0f ? a.v[i] : b.v[i]);
+}
+#undef TRIANGLE_BLOCK_LANEWISE
+inline unsigned MoveMask(Lanes a) {
+  unsigned mask = 0;
+  for (int i = 0; i < kTriangleBlockWidth; i++) {
+    if (a.v[i] != 0.0f) {
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+}
+inline void Store(float* p, Lanes a) {
+  for (int i = 0; i < kTriangleBlockWidth; i++) {
+    p[i] = a.v[i];
+  }
+}
+#endif
+}  // namespace simd
+
+// Moller-Trumbore against every lane of block, with the same operation
+// order as IntersectTriangleEdges so both give bit-identical results.
+// Returns the mask of lanes hit with t >= t_min and t < t_max (or
+// t <= t_max when include_t_max is set), restricted to lane_mask.
+inline unsigned IntersectTriangleBlock(const TriangleBlock& block,
+                                       const glm::vec3& origin,
+                                       const glm::vec3& direction,
+                                       float t_min,
+                                       float t_max,
+                                       bool include_t_max,
+                                       unsigned lane_mask,
+                                       float* t,
+                                       float* beta,
+                                       float* gamma) {
+  using namespace simd;
+  Lanes dx = Splat(direction.x), dy = Splat(direction.y),
+        dz = Splat(direction.z);
+  Lanes e1x = Load(block.e1[0]), e1y = Load(block.e1[1]),
+        e1z = Load(block.e1[2]);
+  Lanes e2x = Load(block.e2[0]), e2y = Load(block.e2[1]),
+        e2z = Load(block.e2[2]);
+
+  // p = cross(direction, e2); det = dot(e1, p).
+  Lanes px = Sub(Mul(dy, e2z), Mul(e2y, dz));
+  Lanes py = Sub(Mul(dz, e2x), Mul(e2z, dx));
+  Lanes pz = Sub(Mul(dx, e2y), Mul(e2x, dy));
+  Lanes det = Add(Add(Mul(e1x, px), Mul(e1y, py)), Mul(e1z, pz));
+  Lanes zero = Splat(0.0f);
+  Lanes one = Splat(1.0f);
+  Lanes inv_det = Div(one, det);
+
+  // s = origin - p0; beta = dot(s, p) / det.
+  Lanes sx = Sub(Splat(origin.x), Load(block.p0[0]));
+  Lanes sy = Sub(Splat(origin.y), Load(block.p0[1]));
+  Lanes sz = Sub(Splat(origin.z), Load(block.p0[2]));
+  Lanes b = Mul(Add(Add(Mul(sx, px), Mul(sy, py)), Mul(sz, pz)), inv_det);
+
+  // q = cross(s, e1); gamma = dot(direction, q) / det.
+  Lanes qx = Sub(Mul(sy, e1z), Mul(e1y, sz));
+  Lanes qy = Sub(Mul(sz, e1x), Mul(e1z, sx));
+  Lanes qz = Sub(Mul(sx, e1y), Mul(e1x, sy));
+  Lanes g = Mul(Add(Add(Mul(dx, qx), Mul(dy, qy)), Mul(dz, qz)), inv_det);
+  Lanes dist =
+      Mul(Add(Add(Mul(e2x, qx), Mul(e2y, qy)), Mul(e2z, qz)), inv_det);
+
+  Lanes t_max_lanes = Splat(t_max);
+  Lanes hit = And(CmpNe(det, zero), And(CmpGe(b, zero), CmpLe(b, one)));
+  hit = And(hit, And(CmpGe(g, zero), CmpLe(Add(b, g), one)));
+  hit = And(hit, CmpGe(dist, Splat(t_min)));
+  hit = And(hit, include_t_max ? CmpLe(dist, t_max_lanes)
+                               : CmpLt(dist, t_max_lanes));
+  unsigned mask = MoveMask(hit) & lane_mask;
+  if (mask != 0 && t != nullptr) {
+    Store(t, dist);
+    Store(beta, b);
+    Store(gamma, g);
+  }
+  return mask;
+}
+
+// Closest-hit over the lanes in lane_mask with t in [t_min, t_max).
+// Returns the lane hit, or -1, and its t and barycentric weights.
+inline int IntersectTriangleBlockClosest(const TriangleBlock& block,
+                                         const glm::vec3& origin,
+                                         const glm::vec3& direction,
+                                         float t_min,
+                                         float t_max,
+                                         unsigned lane_mask,
+                                         float& t,
+                                         float& beta,
+                                         float& gamma) {
+  float ts[kTriangleBlockWidth];
+  float betas[kTriangleBlockWidth];
+  float gammas[kTriangleBlockWidth];
+  unsigned mask =
+      IntersectTriangleBlock(block, origin, direction, t_min, t_max, false,
+                             lane_mask, ts, betas, gammas);
+  int best = -1;
+  for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+    if ((mask & 1) && (best < 0 || ts[lane] < ts[best])) {
+      best = lane;
+    }
+  }
+  if (best >= 0) {
+    t = ts[best];
+    beta = betas[best];
+    gamma = gammas[best];
+  }
+  return best;
+}
+}  // namespace GLOO
+
+#endif
@@ -0,0 +1,100 @@
+#include "Wavefront.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+// Spreads the low 10 bits of v to every third bit.
+uint32_t SpreadBits(uint32_t v) {
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+}  // namespace
+
+namespace GLOO {
+std::vector<uint32_t> BinHitsByObject(const HitBatch& hits,
+                                      size_t num_objects) {
+  // Counting sort; the last bin collects the misses.
+  std::vector<uint32_t> offsets(num_objects + 2, 0);
+  for (uint32_t object : hits.objects) {
+    size_t bin = object == HitBatch::kNoHitObject ? num_objects : object;
+    offsets[bin + 1]++;
+  }
+  for (size_t bin = 1; bin < offsets.size(); bin++) {
+    offsets[bin] += offsets[bin - 1];
+  }
+  std::vector<uint32_t> order(hits.objects.size());
+  for (size_t i = 0; i < hits.objects.size(); i++) {
+    uint32_t object = hits.objects[i];
+    size_t bin = object == HitBatch::kNoHitObject ? num_objects : object;
+    order[offsets[bin]++] = static_cast<uint32_t>(i);
+  }
+  return order;
+}
+
+void SortCoherently(const std::vector<glm::vec3>& origins,
+                    const std::vector<glm::vec3>& directions,
+                    std::vector<uint32_t>& indices) {
+  if (indices.empty()) {
+    return;
+  }
+  glm::vec3 mn = origins[indices[0]];
+  glm::vec3 mx = mn;
+  for (uint32_t i : indices) {
+    mn = glm::min(mn, origins[i]);
+    mx = glm::max(mx, origins[i]);
+  }
+  glm::vec3 extent = mx - mn;
+  glm::vec3 scale(0.0f);
+  for (int axis = 0; axis < 3; axis++) {
+    if (extent[axis] > 0.0f) {
+      scale[axis] = 1023.0f / extent[axis];
+    }
+  }
+
+  // Octant in the top 3 bits, then the 29 most significant bits of the
+  // 30-bit Morton code.
+  std::vector<std::pair<uint32_t, uint32_t>> keys(indices.size());
+  for (size_t k = 0; k < indices.size(); k++) {
+    uint32_t i = indices[k];
+    const glm::vec3& direction = directions[i];
+    uint32_t octant = (direction.x < 0.0f ? 1 : 0) |
+                      (direction.y < 0.0f ? 2 : 0) |
+                      (direction.z < 0.0f ? 4 : 0);
+    glm::vec3 cell = glm::clamp((origins[i] - mn) * scale, glm::vec3(0.0f),
+                                glm::vec3(1023.0f));
+    uint32_t morton = SpreadBits(uint32_t(cell.x)) |
+                      (SpreadBits(uint32_t(cell.y)) << 1) |
+                      (SpreadBits(uint32_t(cell.z)) << 2);
+    keys[k] = std::make_pair((octant << 29) | (morton >> 1), i);
+  }
+  std::sort(keys.begin(), keys.end());
+  for (size_t k = 0; k < indices.size(); k++) {
+    indices[k] = keys[k].second;
+  }
+}
+
+void SortRaysCoherently(RayBatch& rays) {
+  size_t size = rays.GetSize();
+  std::vector<uint32_t> order(size);
+  for (size_t i = 0; i < size; i++) {
+    order[i] = static_cast<uint32_t>(i);
+  }
+  SortCoherently(rays.origins, rays.directions, order);
+
+  RayBatch sorted;
+  sorted.origins.resize(size);
+  sorted.directions.resize(size);
+  sorted.paths.resize(size);
+  for (size_t i = 0; i < size; i++) {
+    sorted.origins[i] = rays.origins[order[i]];
+    sorted.directions[i] = rays.directions[order[i]];
+    sorted.paths[i] = rays.paths[order[i]];
+  }
+  rays.Swap(sorted);
+}
+}  // namespace GLOO
@@ -0,0 +1,142 @@
+#ifndef WAVEFRONT_H_
+#define WAVEFRONT_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "HitRecord.hpp"
+#include "Ray.hpp"
+#include "RayCone.hpp"
+
+namespace GLOO {
+// Buffers of the wavefront engine (see Tracer::RenderPassWavefront). Every
+// stage reads and writes whole batches in structure-of-arrays form.
+
+// State of one pixel sample's path, carried across bounces.
+struct WavefrontPath {
+  glm::vec3 color;
+  glm::vec3 throughput;
+  uint32_t x, y;
+  uint32_t seed;
+  RayCone cone;
+};
+
+// Rays waiting for the extend stage, each continuing path paths[i].
+struct RayBatch {
+  std::vector<glm::vec3> origins;
+  std::vector<glm::vec3> directions;
+  std::vector<uint32_t> paths;
+
+  size_t GetSize() const {
+    return paths.size();
+  }
+  Ray GetRay(size_t i) const {
+    return Ray(origins[i], directions[i]);
+  }
+  void Push(const Ray& ray, uint32_t path) {
+    origins.push_back(ray.GetOrigin());
+    directions.push_back(ray.GetDirection());
+    paths.push_back(path);
+  }
+  void Clear() {
+    origins.clear();
+    directions.clear();
+    paths.clear();
+  }
+  void Swap(RayBatch& other) {
+    origins.swap(other.origins);
+    directions.swap(other.directions);
+    paths.swap(other.paths);
+  }
+};
+
+// Closest hits of a RayBatch, by ray; objects[i] is kNoHitObject on a
+// miss.
+struct HitBatch {
+  static const uint32_t kNoHitObject = 0xffffffff;
+
+  std::vector<HitRecord> records;
+  std::vector<uint32_t> objects;
+
+  void Resize(size_t size) {
+    records.assign(size, HitRecord());
+    objects.assign(size, kNoHitObject);
+  }
+};
+
+// Lighting of the shade stage, one slot per hit and light sample: slot
+// hit * max_samples + k holds the hit's k-th sample. A pending slot adds
+// contributions[slot] to its hit if its shadow ray reaches distances[slot]
+// unblocked.
+struct ShadowBatch {
+  enum Status : uint8_t { kUnused, kPending, kVisible, kOccluded };
+
+  std::vector<glm::vec3> origins;
+  std::vector<glm::vec3> directions;
+  std::vector<float> distances;
+  std::vector<glm::vec3> contributions;
+  std::vector<uint8_t> status;
+
+  void Resize(size_t size) {
+    origins.resize(size);
+    directions.resize(size);
+    distances.resize(size);
+    contributions.resize(size);
+    status.assign(size, kUnused);
+  }
+};
+
+// Indices of the hits in hits grouped by object, and so by material, with
+// misses last; within an object, hits keep their order.
+std::vector<uint32_t> BinHitsByObject(const HitBatch& hits,
+                                      size_t num_objects);
+
+// Sorts indices of rays given by origins and directions so that rays
+// going into the same octant are adjacent, and within an octant are in
+// Morton order of their origins inside the origins' bounding box.
+// Neighbouring rays then tend to visit the same nodes.
+void SortCoherently(const std::vector<glm::vec3>& origins,
+                    const std::vector<glm::vec3>& directions,
+                    std::vector<uint32_t>& indices);
+// Reorders rays the same way.
+void SortRaysCoherently(RayBatch& rays);
+
+// Calls body(begin, end) over chunks of [0, count) on up to num_threads
+// threads.
+template <typename Body>
+void ParallelFor(size_t count, size_t num_threads, Body body) {
+  // Chunks small enough to balance, large enough to amortize the atomics.
+  const size_t kChunkSize = 256;
+  size_t num_chunks = (count + kChunkSize - 1) / kChunkSize;
+  num_threads = std::max<size_t>(1, std::min(num_threads, num_chunks));
+  if (num_threads == 1) {
+    if (count > 0) {
+      body(size_t(0), count);
+    }
+    return;
+  }
+  std::atomic<size_t> next_chunk(0);
+  auto worker = [&]() {
+    size_t chunk;
+    while ((chunk = next_chunk++) < num_chunks) {
+      size_t begin = chunk * kChunkSize;
+      body(begin, std::min(count, begin + kChunkSize));
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+}  // namespace GLOO
+
+#endif
@@ -1,8 +1,10 @@
 #ifndef HITTABLE_BASE_H_
 #define HITTABLE_BASE_H_
 
+#include "AABB.hpp"
 #include "Ray.hpp"
 #include "HitRecord.hpp"
+#include "RayPacket.hpp"
 
 namespace GLOO {
 class HittableBase {
@@ -11,6 +13,30 @@ class HittableBase {
   virtual bool Intersect(const Ray& ray,
                          float t_min,
                          HitRecord& record) const = 0;
+  // Any-hit query: whether something is hit with t in [t_min, t_max].
+  // Stops at the first hit found instead of searching for the closest.
+  virtual bool Occluded(const Ray& ray, float t_min, float t_max) const = 0;
+  // Intersect for every active ray of packet, with records[lane] holding
+  // each ray's closest hit so far. Returns the lanes whose record changed.
+  virtual unsigned IntersectPacket(const RayPacket& packet,
+                                   float t_min,
+                                   HitRecord* records) const {
+    unsigned hit = 0;
+    for (int lane = 0; lane < kPacketSize; lane++) {
+      if ((packet.mask & (1u << lane)) &&
+          Intersect(packet.GetRay(lane), t_min, records[lane])) {
+        hit |= 1u << lane;
+      }
+    }
+    return hit;
+  }
+  // How fast the normal turns along the surface at the hit in record, in
+  // radians per local unit; 0 for flat surfaces.
+  virtual float GetCurvature(const HitRecord& record) const {
+    return 0.0f;
+  }
+  // Bounds in local coordinates; unbounded shapes return an infinite box.
+  virtual AABB GetLocalBounds() const = 0;
   virtual ~HittableBase() {
   }
 };
@@ -6,28 +6,110 @@
 
 #include "gloo/utils.hpp"
 
+#include "BVH.hpp"
+#include "LazyBVH.hpp"
+#include "MappedFile.hpp"
+#include "Octree.hpp"
+
 namespace GLOO {
 Mesh::Mesh(std::unique_ptr<PositionArray> positions,
            std::unique_ptr<NormalArray> normals,
-           std::unique_ptr<IndexArray> indices) {
-  size_t num_vertices = indices->size();
-  if (num_vertices % 3 != 0 || normals->size() != positions->size())
-    throw std::runtime_error("Bad mesh data in Mesh constuctor!");
+           std::unique_ptr<IndexArray> indices,
+           AccelType accel_type)
+    : position_storage_(std::move(*positions)),
+      normal_storage_(std::move(*normals)),
+      index_storage_(std::move(*indices)) {
+  // The parser grows these by appending; drop the spare capacity since
+  // they are kept for the mesh's lifetime.
+  position_storage_.shrink_to_fit();
+  normal_storage_.shrink_to_fit();
+  index_storage_.shrink_to_fit();
+  positions_ = position_storage_;
+  normals_ = normal_storage_;
+  indices_ = index_storage_;
+  Validate();
+
+  bbox_ = AABB::FromMesh(*this);
 
-  for (size_t i = 0; i < num_vertices; i += 3) {
-    triangles_.emplace_back(
-        positions->at(indices->at(i)), positions->at(indices->at(i + 1)),
-        positions->at(indices->at(i + 2)), normals->at(indices->at(i)),
-        normals->at(indices->at(i + 1)), normals->at(indices->at(i + 2)));
+  if (accel_type == AccelType::BVH) {
+    accel_ = make_unique<BVH>();
+  } else if (accel_type == AccelType::LazyBVH) {
+    accel_ = make_unique<LazyBVH>();
+  } else {
+    accel_ = make_unique<Octree>();
   }
-  // Let mesh data destruct.
+  accel_->Build(*this);
+}
 
-  // Build Octree.
-  octree_ = make_unique<Octree>();
-  octree_->Build(*this);
+Mesh::Mesh(std::shared_ptr<const MappedFile> file,
+           const AABB& bbox,
+           ArrayView<glm::vec3> positions,
+           ArrayView<glm::vec3> normals,
+           ArrayView<unsigned int> indices,
+           ArrayView<BVHNode> nodes,
+           ArrayView<uint32_t> prim_indices,
+           ArrayView<TriangleBlock> blocks)
+    : positions_(positions),
+      normals_(normals),
+      indices_(indices),
+      file_(std::move(file)),
+      bbox_(bbox) {
+  Validate();
+  auto bvh = make_unique<BVH>();
+  bvh->Adopt(*this, nodes, prim_indices, blocks);
+  accel_ = std::move(bvh);
+}
+
+void Mesh::Validate() const {
+  size_t num_vertices = indices_.size();
+  if (num_vertices == 0 || num_vertices % 3 != 0 ||
+      normals_.size() != positions_.size())
+    throw std::runtime_error("Bad mesh data in Mesh constuctor!");
+  for (unsigned int index : indices_) {
+    if (index >= positions_.size())
+      throw std::runtime_error("Mesh index out of range!");
+  }
+}
+
+const BVH* Mesh::GetBVH() const {
+  return dynamic_cast<const BVH*>(accel_.get());
 }
 
 bool Mesh::Intersect(const Ray& ray, float t_min, HitRecord& record) const {
-  return octree_->Intersect(ray, t_min, record);
+  return accel_->Intersect(ray, t_min, record);
+}
+
+bool Mesh::Occluded(const Ray& ray, float t_min, float t_max) const {
+  return accel_->Occluded(ray, t_min, t_max);
+}
+
+unsigned Mesh::IntersectPacket(const RayPacket& packet,
+                               float t_min,
+                               HitRecord* records) const {
+  return accel_->IntersectPacket(packet, t_min, records);
+}
+
+AABB Mesh::GetTriangleBounds(size_t triangle) const {
+  glm::vec3 p0 = GetPosition(triangle, 0);
+  glm::vec3 p1 = GetPosition(triangle, 1);
+  glm::vec3 p2 = GetPosition(triangle, 2);
+  return AABB(glm::min(p0, glm::min(p1, p2)), glm::max(p0, glm::max(p1, p2)));
+}
+
+float Mesh::GetCurvature(const HitRecord& record) const {
+  glm::vec3 positions[3];
+  glm::vec3 normals[3];
+  for (int corner = 0; corner < 3; corner++) {
+    unsigned int index = indices_[3 * record.primitive + corner];
+    positions[corner] = positions_[index];
+    normals[corner] = normals_[index];
+  }
+  return EstimateCurvature(positions, normals);
+}
+
+size_t Mesh::GetGeometryMemoryUsage() const {
+  return positions_.size() * sizeof(glm::vec3) +
+         normals_.size() * sizeof(glm::vec3) +
+         indices_.size() * sizeof(unsigned int);
 }
 }  // namespace GLOO
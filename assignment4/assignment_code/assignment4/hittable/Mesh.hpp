@@ -1,31 +1,111 @@
 #ifndef MESH_H_
 #define MESH_H_
 
+#include <cstdint>
+#include <memory>
+
 #include "HittableBase.hpp"
 
 #include "gloo/alias_types.hpp"
 
 #include "Triangle.hpp"
-#include "Octree.hpp"
+#include "AccelStructure.hpp"
+#include "ArrayView.hpp"
 
 namespace GLOO {
-class Octree;
+class BVH;
+class MappedFile;
+struct BVHNode;
+struct TriangleBlock;
 
+// Indexed triangle mesh. Vertices are shared between triangles through the
+// index buffer; the acceleration structure keeps its own intersection-ready
+// copy of the triangles (see TriangleBlock).
 class Mesh : public HittableBase {
  public:
   Mesh(std::unique_ptr<PositionArray> positions,
        std::unique_ptr<NormalArray> normals,
-       std::unique_ptr<IndexArray> indices);
+       std::unique_ptr<IndexArray> indices,
+       AccelType accel_type);
+  // Mesh over arrays that live in file, such as a mapped accel cache,
+  // traced by a BVH adopting the arrays built for it earlier. Nothing is
+  // copied; the mesh keeps file alive.
+  Mesh(std::shared_ptr<const MappedFile> file,
+       const AABB& bbox,
+       ArrayView<glm::vec3> positions,
+       ArrayView<glm::vec3> normals,
+       ArrayView<unsigned int> indices,
+       ArrayView<BVHNode> nodes,
+       ArrayView<uint32_t> prim_indices,
+       ArrayView<TriangleBlock> blocks);
 
   bool Intersect(const Ray& ray, float t_min, HitRecord& record) const override;
-  const std::vector<Triangle>& GetTriangles() const {
-    return triangles_;
+  bool Occluded(const Ray& ray, float t_min, float t_max) const override;
+  unsigned IntersectPacket(const RayPacket& packet,
+                           float t_min,
+                           HitRecord* records) const override;
+  float GetCurvature(const HitRecord& record) const override;
+  AABB GetLocalBounds() const override {
+    return bbox_;
+  }
+
+  size_t GetNumTriangles() const {
+    return indices_.size() / 3;
+  }
+  glm::vec3 GetPosition(size_t triangle, size_t corner) const {
+    return positions_[indices_[3 * triangle + corner]];
+  }
+  AABB GetTriangleBounds(size_t triangle) const;
+  // Fills record for a hit on triangle at t with barycentric weights
+  // beta and gamma, interpolating the vertex normals.
+  void RecordHit(uint32_t triangle,
+                 float t,
+                 float beta,
+                 float gamma,
+                 HitRecord& record) const;
+  // Bytes held by the vertex and index arrays.
+  size_t GetGeometryMemoryUsage() const;
+
+  ArrayView<glm::vec3> GetPositions() const {
+    return positions_;
+  }
+  ArrayView<glm::vec3> GetNormals() const {
+    return normals_;
+  }
+  ArrayView<unsigned int> GetIndices() const {
+    return indices_;
   }
+  // The mesh's BVH, or nullptr if it uses another structure.
+  const BVH* GetBVH() const;
 
  private:
-  std::vector<Triangle> triangles_;
-  std::unique_ptr<Octree> octree_;
+  void Validate() const;
+
+  // Views of either the storage vectors below or of file_'s contents.
+  ArrayView<glm::vec3> positions_;
+  ArrayView<glm::vec3> normals_;
+  ArrayView<unsigned int> indices_;
+  PositionArray position_storage_;
+  NormalArray normal_storage_;
+  IndexArray index_storage_;
+  std::shared_ptr<const MappedFile> file_;
+  AABB bbox_;
+  std::unique_ptr<AccelStructure> accel_;
 };
+
+inline void Mesh::RecordHit(uint32_t triangle,
+                            float t,
+                            float beta,
+                            float gamma,
+                            HitRecord& record) const {
+  const unsigned int* index = &indices_[3 * triangle];
+  float alpha = 1 - beta - gamma;
+  record.time = t;
+  record.primitive = triangle;
+  record.normal = glm::normalize(alpha * normals_[index[0]] +
+                                 beta * normals_[index[1]] +
+                                 gamma * normals_[index[2]]);
+}
 }  // namespace GLOO
 
 #endif
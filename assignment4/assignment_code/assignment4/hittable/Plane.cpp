@@ -1,11 +1,18 @@
 #include "Plane.hpp"
 
+#include <limits>
+
 namespace GLOO {
 Plane::Plane(const glm::vec3& normal, float d) {
   normal_ = normal;
   d_ = -d;
 }
 
+AABB Plane::GetLocalBounds() const {
+  float inf = std::numeric_limits<float>::infinity();
+  return AABB(glm::vec3(-inf), glm::vec3(inf));
+}
+
 bool Plane::Intersect(const Ray& ray, float t_min, HitRecord& record) const {
   // TODO: Implement ray-plane intersection.
   
@@ -26,4 +33,10 @@ bool Plane::Intersect(const Ray& ray, float t_min, HitRecord& record) const {
   return false;
 
 }
+
+bool Plane::Occluded(const Ray& ray, float t_min, float t_max) const {
+  float t = -(d_ + glm::dot(normal_, ray.GetOrigin())) /
+            glm::dot(normal_, ray.GetDirection());
+  return t >= t_min && t <= t_max;
+}
 }  // namespace GLOO
@@ -8,6 +8,8 @@ class Plane : public HittableBase {
  public:
   Plane(const glm::vec3& normal, float d);
   bool Intersect(const Ray& ray, float t_min, HitRecord& record) const override;
+  bool Occluded(const Ray& ray, float t_min, float t_max) const override;
+  AABB GetLocalBounds() const override;
 
 
   private:
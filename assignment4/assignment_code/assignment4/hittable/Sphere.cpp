@@ -39,4 +39,21 @@ bool Sphere::Intersect(const Ray& ray, float t_min, HitRecord& record) const {
 
   return false;
 }
+
+bool Sphere::Occluded(const Ray& ray, float t_min, float t_max) const {
+  float a = glm::length2(ray.GetDirection());
+  float b = 2 * glm::dot(ray.GetDirection(), ray.GetOrigin());
+  float c = glm::length2(ray.GetOrigin()) - radius_ * radius_;
+
+  float d = b * b - 4 * a * c;
+  if (d < 0) {
+    return false;
+  }
+  d = sqrt(d);
+
+  float t_plus = (-b + d) / (2 * a);
+  float t_minus = (-b - d) / (2 * a);
+  float t = t_minus < t_min ? t_plus : t_minus;
+  return t >= t_min && t <= t_max;
+}
 }  // namespace GLOO
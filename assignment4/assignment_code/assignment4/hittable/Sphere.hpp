@@ -10,6 +10,13 @@ class Sphere : public HittableBase {
   Sphere(float radius) : radius_(radius) {
   }
   bool Intersect(const Ray& ray, float t_min, HitRecord& record) const override;
+  bool Occluded(const Ray& ray, float t_min, float t_max) const override;
+  float GetCurvature(const HitRecord& record) const override {
+    return 1.0f / radius_;
+  }
+  AABB GetLocalBounds() const override {
+    return AABB(glm::vec3(-radius_), glm::vec3(radius_));
+  }
 
  private:
   float radius_;
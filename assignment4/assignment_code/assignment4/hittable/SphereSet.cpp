@@ -0,0 +1,227 @@
+#include "SphereSet.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "MappedFile.hpp"
+#include "TraceStats.hpp"
+#include "TriangleBlock.hpp"
+
+namespace GLOO {
+namespace {
+// The kernel tests as many spheres at once as a triangle block holds.
+const int kSphereLanes = kTriangleBlockWidth;
+
+// Tests the spheres at slots [0, kSphereLanes) of the center and radius
+// arrays against the ray. Like Sphere, a ray starting inside a sphere hits
+// its far side. Returns the mask of lanes hit with t >= t_min and
+// t < t_max (or t <= t_max when include_t_max is set), restricted to
+// lane_mask, and stores their t.
+unsigned IntersectSphereLanes(const float* center_x,
+                              const float* center_y,
+                              const float* center_z,
+                              const float* radii,
+                              const glm::vec3& origin,
+                              const glm::vec3& direction,
+                              float t_min,
+                              float t_max,
+                              bool include_t_max,
+                              unsigned lane_mask,
+                              float* t) {
+  using namespace simd;
+  Lanes dx = Splat(direction.x), dy = Splat(direction.y),
+        dz = Splat(direction.z);
+  // oc = center - origin; the hits solve a t^2 - 2 b t + c = 0.
+  Lanes ocx = Sub(Load(center_x), Splat(origin.x));
+  Lanes ocy = Sub(Load(center_y), Splat(origin.y));
+  Lanes ocz = Sub(Load(center_z), Splat(origin.z));
+  Lanes r = Load(radii);
+  Lanes a = Splat(glm::dot(direction, direction));
+  Lanes b = Add(Add(Mul(ocx, dx), Mul(ocy, dy)), Mul(ocz, dz));
+  Lanes c = Sub(Add(Add(Mul(ocx, ocx), Mul(ocy, ocy)), Mul(ocz, ocz)),
+                Mul(r, r));
+  Lanes disc = Sub(Mul(b, b), Mul(a, c));
+  Lanes zero = Splat(0.0f);
+  Lanes root = Sqrt(Select(CmpGe(disc, zero), disc, zero));
+  Lanes t_near = Div(Sub(b, root), a);
+  Lanes t_far = Div(Add(b, root), a);
+  Lanes t_min_lanes = Splat(t_min);
+  Lanes dist = Select(CmpGe(t_near, t_min_lanes), t_near, t_far);
+
+  Lanes t_max_lanes = Splat(t_max);
+  Lanes hit = And(CmpGe(disc, zero), CmpGe(dist, t_min_lanes));
+  hit = And(hit, include_t_max ? CmpLe(dist, t_max_lanes)
+                               : CmpLt(dist, t_max_lanes));
+  unsigned mask = MoveMask(hit) & lane_mask;
+  if (mask != 0 && t != nullptr) {
+    Store(t, dist);
+  }
+  return mask;
+}
+
+// Float stored as little-endian bytes at data, on hosts of either order.
+float ReadLittleEndianFloat(const char* data) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  uint32_t bits = uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 |
+                  uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24;
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+unsigned GetLaneMask(uint32_t remaining) {
+  return remaining >= uint32_t(kSphereLanes) ? (1u << kSphereLanes) - 1
+                                             : (1u << remaining) - 1;
+}
+}  // namespace
+
+SphereSet::SphereSet(const std::vector<glm::vec4>& spheres)
+    : num_spheres_(spheres.size()), bvh_(kSphereLanes) {
+  if (spheres.empty()) {
+    throw std::runtime_error("Cannot build an empty sphere set!");
+  }
+  std::vector<AABB> bounds(spheres.size());
+  bbox_ = AABB::Empty();
+  for (size_t i = 0; i < spheres.size(); i++) {
+    glm::vec3 center(spheres[i]);
+    float radius = spheres[i].w;
+    if (!(radius > 0.0f) || !std::isfinite(radius) ||
+        !std::isfinite(center.x) || !std::isfinite(center.y) ||
+        !std::isfinite(center.z)) {
+      throw std::runtime_error("Bad sphere in sphere set!");
+    }
+    bounds[i] = AABB(center - radius, center + radius);
+    bbox_.UnionWith(bounds[i]);
+  }
+  bvh_.BuildFromBounds(bounds);
+
+  // Lay the spheres out in the order of the BVH's leaves.
+  size_t padded = spheres.size() + kSphereLanes - 1;
+  center_x_.assign(padded, 0.0f);
+  center_y_.assign(padded, 0.0f);
+  center_z_.assign(padded, 0.0f);
+  radii_.assign(padded, 0.0f);
+  for (size_t i = 0; i < spheres.size(); i++) {
+    const glm::vec4& sphere = spheres[bvh_.GetPrimIndex(uint32_t(i))];
+    center_x_[i] = sphere.x;
+    center_y_[i] = sphere.y;
+    center_z_[i] = sphere.z;
+    radii_[i] = sphere.w;
+  }
+}
+
+bool SphereSet::IntersectLeaf(const BVHNode& leaf,
+                              const glm::vec3& origin,
+                              const glm::vec3& direction,
+                              float t_min,
+                              HitRecord& record) const {
+  TRACE_STATS_ADD(triangle_tests, leaf.count);
+  int best = -1;
+  float best_t = record.time;
+  uint32_t end = leaf.offset + leaf.count;
+  for (uint32_t first = leaf.offset; first < end; first += kSphereLanes) {
+    float ts[kSphereLanes];
+    unsigned mask = IntersectSphereLanes(
+        &center_x_[first], &center_y_[first], &center_z_[first],
+        &radii_[first], origin, direction, t_min, best_t, false,
+        GetLaneMask(end - first), ts);
+    for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+      if ((mask & 1) && ts[lane] < best_t) {
+        best = int(first) + lane;
+        best_t = ts[lane];
+      }
+    }
+  }
+  if (best < 0) {
+    return false;
+  }
+  glm::vec3 center(center_x_[best], center_y_[best], center_z_[best]);
+  record.time = best_t;
+  record.primitive = uint32_t(best);
+  record.normal = glm::normalize(origin + best_t * direction - center);
+  return true;
+}
+
+bool SphereSet::Intersect(const Ray& ray,
+                          float t_min,
+                          HitRecord& record) const {
+  return bvh_.TraverseLeaves(
+      ray, t_min, record, [&](const BVHNode& leaf, HitRecord& rec) {
+        return IntersectLeaf(leaf, ray.GetOrigin(), ray.GetDirection(), t_min,
+                             rec);
+      });
+}
+
+unsigned SphereSet::IntersectPacket(const RayPacket& packet,
+                                    float t_min,
+                                    HitRecord* records) const {
+  return bvh_.TraversePacket(
+      packet, t_min, records,
+      [&](const BVHNode& leaf, unsigned lanes, HitRecord* recs) {
+        unsigned intersected = 0;
+        for (int lane = 0; lane < kPacketSize; lane++) {
+          if ((lanes & (1u << lane)) &&
+              IntersectLeaf(leaf, packet.origins[lane],
+                            packet.directions[lane], t_min, recs[lane])) {
+            intersected |= 1u << lane;
+          }
+        }
+        return intersected;
+      },
+      [&](int lane, const BVHNode& leaf, HitRecord& rec) {
+        return IntersectLeaf(leaf, packet.origins[lane],
+                             packet.directions[lane], t_min, rec);
+      });
+}
+
+bool SphereSet::Occluded(const Ray& ray, float t_min, float t_max) const {
+  const glm::vec3& origin = ray.GetOrigin();
+  const glm::vec3& direction = ray.GetDirection();
+  return bvh_.TraverseLeavesAny(ray, t_min, t_max, [&](const BVHNode& leaf) {
+    TRACE_STATS_ADD(triangle_tests, leaf.count);
+    uint32_t end = leaf.offset + leaf.count;
+    for (uint32_t first = leaf.offset; first < end; first += kSphereLanes) {
+      if (IntersectSphereLanes(&center_x_[first], &center_y_[first],
+                               &center_z_[first], &radii_[first], origin,
+                               direction, t_min, t_max, true,
+                               GetLaneMask(end - first), nullptr)) {
+        return true;
+      }
+    }
+    return false;
+  });
+}
+
+size_t SphereSet::GetMemoryUsage() const {
+  return 4 * center_x_.capacity() * sizeof(float) + bvh_.GetMemoryUsage();
+}
+
+std::vector<glm::vec4> LoadSphereFile(const std::string& path, float radius) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    throw std::runtime_error("Cannot open sphere file " + path + "!");
+  }
+  size_t floats_per_sphere = radius > 0.0f ? 3 : 4;
+  size_t record_size = floats_per_sphere * sizeof(float);
+  if (!std::isfinite(radius) || file.GetSize() == 0 ||
+      file.GetSize() % record_size != 0) {
+    throw std::runtime_error("Bad sphere file " + path + "!");
+  }
+  std::vector<glm::vec4> spheres(file.GetSize() / record_size);
+  for (size_t i = 0; i < spheres.size(); i++) {
+    const char* record = file.GetData() + i * record_size;
+    float values[4] = {0.0f, 0.0f, 0.0f, radius};
+    for (size_t k = 0; k < floats_per_sphere; k++) {
+      values[k] = ReadLittleEndianFloat(record + k * sizeof(float));
+    }
+    if (!std::isfinite(values[0]) || !std::isfinite(values[1]) ||
+        !std::isfinite(values[2]) || !std::isfinite(values[3]) ||
+        !(values[3] > 0.0f)) {
+      throw std::runtime_error("Bad sphere file " + path + "!");
+    }
+    spheres[i] = glm::vec4(values[0], values[1], values[2], values[3]);
+  }
+  return spheres;
+}
+}  // namespace GLOO
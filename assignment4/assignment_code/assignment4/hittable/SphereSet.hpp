@@ -0,0 +1,66 @@
+#ifndef SPHERE_SET_H_
+#define SPHERE_SET_H_
+
+#include <string>
+#include <vector>
+
+#include "HittableBase.hpp"
+
+#include "BVH.hpp"
+
+namespace GLOO {
+// Many spheres traced as one object, e.g. the particles of a simulation.
+// Centers and radii are kept as separate arrays in the order of the set's
+// own BVH, so each leaf's spheres are contiguous and tested several at a
+// time with the SIMD helpers of TriangleBlock. HitRecord::primitive is the
+// position of the sphere hit in that order.
+class SphereSet : public HittableBase {
+ public:
+  // Each sphere is given as its center in xyz and its radius in w.
+  explicit SphereSet(const std::vector<glm::vec4>& spheres);
+
+  bool Intersect(const Ray& ray, float t_min, HitRecord& record) const override;
+  bool Occluded(const Ray& ray, float t_min, float t_max) const override;
+  unsigned IntersectPacket(const RayPacket& packet,
+                           float t_min,
+                           HitRecord* records) const override;
+  float GetCurvature(const HitRecord& record) const override {
+    return 1.0f / radii_[record.primitive];
+  }
+  AABB GetLocalBounds() const override {
+    return bbox_;
+  }
+
+  size_t GetNumSpheres() const {
+    return num_spheres_;
+  }
+  // Bytes held by the sphere arrays and the BVH.
+  size_t GetMemoryUsage() const;
+
+ private:
+  bool IntersectLeaf(const BVHNode& leaf,
+                     const glm::vec3& origin,
+                     const glm::vec3& direction,
+                     float t_min,
+                     HitRecord& record) const;
+
+  size_t num_spheres_;
+  // Padded with empty lanes so the kernel can load a full set of lanes
+  // from any sphere.
+  std::vector<float> center_x_;
+  std::vector<float> center_y_;
+  std::vector<float> center_z_;
+  std::vector<float> radii_;
+  AABB bbox_;
+  BVH bvh_;
+};
+
+// Reads a sphere file: consecutive little-endian float32 records of
+// center x, y, z and radius, or of the center alone when radius > 0 gives
+// one radius for all spheres. Throws if the file is missing, has a size
+// that is not a whole number of records, or holds a sphere with a
+// non-finite center or a radius that is not finite and positive.
+std::vector<glm::vec4> LoadSphereFile(const std::string& path, float radius);
+}  // namespace GLOO
+
+#endif
@@ -15,42 +15,45 @@ Triangle::Triangle(const glm::vec3& p0,
                    const glm::vec3& n0,
                    const glm::vec3& n1,
                    const glm::vec3& n2) {
-  positions_.push_back(p0);
-  positions_.push_back(p1);
-  positions_.push_back(p2);
-  normals_.push_back(n0);
-  normals_.push_back(n1);
-  normals_.push_back(n2);
+  positions_[0] = p0;
+  positions_[1] = p1;
+  positions_[2] = p2;
+  normals_[0] = n0;
+  normals_[1] = n1;
+  normals_[2] = n2;
 }
 
 Triangle::Triangle(const std::vector<glm::vec3>& positions,
                    const std::vector<glm::vec3>& normals) {
+  if (positions.size() != 3 || normals.size() != 3)
+    throw std::runtime_error("A triangle needs three positions and normals!");
+  for (size_t i = 0; i < 3; i++) {
+    positions_[i] = positions[i];
+    normals_[i] = normals[i];
+  }
 }
 
 bool Triangle::Intersect(const Ray& ray, float t_min, HitRecord& record) const {
-  // TODO: Implement ray-triangle intersection.
-  
-  glm::vec3 R_0 = ray.GetOrigin();
-  glm::vec3 R_d = ray.GetDirection();
-
-  glm::mat3 A = glm::mat3(positions_[0] - positions_[1], positions_[0] - positions_[2], R_d);
-  glm::vec3 b = positions_[0] - R_0;
-  glm::vec3 x = glm::inverse(A) * b;
-  
-  float beta = x[0];
-  float gamma = x[1];
-  float alpha = 1 - beta - gamma;
-  float t = x[2];
-
-  if (beta + gamma > 1 || beta < 0 || gamma < 0 || t < t_min) {
+  float t, beta, gamma;
+  if (!IntersectTriangleEdges(ray.GetOrigin(), ray.GetDirection(),
+                              positions_[0], positions_[1] - positions_[0],
+                              positions_[2] - positions_[0], t, beta, gamma) ||
+      t < t_min || t >= record.time) {
     return false;
-  } else{
-    if (t < record.time) {
-      record.time = t;
-      record.normal = glm::normalize(alpha * normals_[0] + beta * normals_[1] + gamma * normals_[2]);  // Interpolate normals
-      return true;
-    }
   }
-  return false;
+  float alpha = 1 - beta - gamma;
+  record.time = t;
+  record.normal = glm::normalize(alpha * normals_[0] + beta * normals_[1] +
+                                 gamma * normals_[2]);  // Interpolate normals
+  return true;
+}
+
+bool Triangle::Occluded(const Ray& ray, float t_min, float t_max) const {
+  float t, beta, gamma;
+  return IntersectTriangleEdges(ray.GetOrigin(), ray.GetDirection(),
+                                positions_[0], positions_[1] - positions_[0],
+                                positions_[2] - positions_[0], t, beta,
+                                gamma) &&
+         t >= t_min && t <= t_max;
 }
 }  // namespace GLOO
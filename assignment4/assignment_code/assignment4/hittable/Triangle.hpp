@@ -1,11 +1,59 @@
 #ifndef TRIANGLE_H_
 #define TRIANGLE_H_
 
+#include <algorithm>
 #include <vector>
 
 #include "HittableBase.hpp"
 
 namespace GLOO {
+// Moller-Trumbore test against the triangle with first vertex p0 and edges
+// e1 = p1 - p0 and e2 = p2 - p0. On a hit, t is the ray parameter and beta
+// and gamma are the barycentric weights of p1 and p2.
+inline bool IntersectTriangleEdges(const glm::vec3& origin,
+                                   const glm::vec3& direction,
+                                   const glm::vec3& p0,
+                                   const glm::vec3& e1,
+                                   const glm::vec3& e2,
+                                   float& t,
+                                   float& beta,
+                                   float& gamma) {
+  glm::vec3 p = glm::cross(direction, e2);
+  float det = glm::dot(e1, p);
+  if (det == 0.0f) {
+    return false;
+  }
+  float inv_det = 1.0f / det;
+  glm::vec3 s = origin - p0;
+  beta = glm::dot(s, p) * inv_det;
+  if (!(beta >= 0.0f && beta <= 1.0f)) {
+    return false;
+  }
+  glm::vec3 q = glm::cross(s, e1);
+  gamma = glm::dot(direction, q) * inv_det;
+  if (!(gamma >= 0.0f && beta + gamma <= 1.0f)) {
+    return false;
+  }
+  t = glm::dot(e2, q) * inv_det;
+  return true;
+}
+
+// Curvature implied by a triangle's vertex normals: the largest turn of
+// the normal per unit length along an edge.
+inline float EstimateCurvature(const glm::vec3 positions[3],
+                               const glm::vec3 normals[3]) {
+  float curvature = 0.0f;
+  for (int i = 0; i < 3; i++) {
+    int j = (i + 1) % 3;
+    float edge = glm::length(positions[j] - positions[i]);
+    if (edge > 0.0f) {
+      curvature = std::max(
+          curvature, glm::length(normals[j] - normals[i]) / edge);
+    }
+  }
+  return curvature;
+}
+
 class Triangle : public HittableBase {
  public:
   Triangle(const glm::vec3& p0,
@@ -18,6 +66,13 @@ class Triangle : public HittableBase {
            const std::vector<glm::vec3>& normals);
 
   bool Intersect(const Ray& ray, float t_min, HitRecord& record) const override;
+  bool Occluded(const Ray& ray, float t_min, float t_max) const override;
+  float GetCurvature(const HitRecord& record) const override {
+    return EstimateCurvature(positions_, normals_);
+  }
+  AABB GetLocalBounds() const override {
+    return AABB::FromTriangle(*this);
+  }
   glm::vec3 GetPosition(size_t i) const {
     return positions_[i];
   }
@@ -26,8 +81,8 @@ class Triangle : public HittableBase {
   }
 
  private:
-  std::vector<glm::vec3> positions_;
-  std::vector<glm::vec3> normals_;
+  glm::vec3 positions_[3];
+  glm::vec3 normals_[3];
 };
 }  // namespace GLOO
 
@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <iostream>
 #include <chrono>
+#include <stdexcept>
 
 #include "gloo/Scene.hpp"
 #include "gloo/components/MaterialComponent.hpp"
@@ -8,18 +10,69 @@
 #include "Tracer.hpp"
 #include "SceneParser.hpp"
 #include "ArgParser.hpp"
+#include "TraceStats.hpp"
 
 using namespace GLOO;
 
 int main(int argc, const char* argv[]) {
   ArgParser arg_parser(argc, argv);
-  SceneParser scene_parser;
+  SceneParser scene_parser(ParseAccelType(arg_parser.accel),
+                           arg_parser.accel_cache);
   auto scene = scene_parser.ParseScene("assignment4/" + arg_parser.input_file);
+  if (scene_parser.GetNumMeshInstances() > 0) {
+    std::cout << "Loaded " << scene_parser.GetNumUniqueMeshes()
+              << " unique meshes for " << scene_parser.GetNumMeshInstances()
+              << " mesh nodes" << std::endl;
+  }
 
+  SamplingSpec sampling;
+  sampling.samples_per_pixel = arg_parser.spp;
+  sampling.time_budget = arg_parser.time_budget;
+  sampling.snapshot_every = arg_parser.snapshot_every;
+  sampling.jitter = arg_parser.jitter;
+  sampling.filter = arg_parser.filter;
+  sampling.cube_map_lod = arg_parser.cube_map_lod;
+  sampling.adaptive_threshold = arg_parser.adaptive;
+  sampling.adaptive_min_samples = arg_parser.adaptive_min;
+  sampling.min_throughput = arg_parser.min_throughput;
+  sampling.roulette_depth = arg_parser.roulette;
+  sampling.light_cutoff = arg_parser.light_cutoff;
+  sampling.light_samples = arg_parser.light_samples;
   Tracer tracer(scene_parser.GetCameraSpec(),
                 glm::ivec2(arg_parser.width, arg_parser.height),
                 arg_parser.bounces, scene_parser.GetBackgroundColor(),
-                scene_parser.GetCubeMapPtr(), arg_parser.shadows);
-  tracer.Render(*scene, arg_parser.output_file);
+                scene_parser.GetCubeMapPtr(), arg_parser.shadows,
+                arg_parser.threads, arg_parser.packets,
+                arg_parser.wavefront, sampling);
+  AovOutputs aov_outputs;
+  aov_outputs.depth_file = arg_parser.depth_file;
+  aov_outputs.depth_min = arg_parser.depth_min;
+  aov_outputs.depth_max = arg_parser.depth_max;
+  aov_outputs.normals_file = arg_parser.normals_file;
+  aov_outputs.ids_file = arg_parser.ids_file;
+  aov_outputs.heatmap_file = arg_parser.heatmap_file;
+  if (arg_parser.render_region) {
+    if (!aov_outputs.IsEmpty() || arg_parser.stream_output) {
+      throw std::runtime_error(
+          "Region renders write neither AOVs nor streamed output!");
+    }
+    // Tiles use image rows, which count from the bottom.
+    size_t height = arg_parser.height;
+    Tile region{arg_parser.region_x0,
+                height - std::min(arg_parser.region_y1, height),
+                arg_parser.region_x1,
+                height - std::min(arg_parser.region_y0, height)};
+    tracer.RenderRegion(*scene, region, arg_parser.output_file);
+  } else if (arg_parser.stream_output) {
+    if (!aov_outputs.IsEmpty()) {
+      throw std::runtime_error("Streamed output cannot write AOVs!");
+    }
+    tracer.RenderStreaming(*scene, arg_parser.output_file);
+  } else {
+    tracer.Render(*scene, arg_parser.output_file, aov_outputs);
+  }
+  if (arg_parser.stats) {
+    PrintStatsSummary(std::cout);
+  }
   return 0;
 }
@@ -0,0 +1,264 @@
+// Renders scenes 1-7 of the assignment with fixed settings and reports
+// their throughput as JSON, to catch performance regressions in the
+// tracer and its acceleration structures:
+//
+//   tracer_benchmark [-repetitions n] [-warmup n] [-threads n]
+//                    [-no-packets] [-wavefront] [-output report.json]
+//
+// Each case loads its scene and renders it warmup times untimed, then
+// repetitions times timed, and reports medians. Ray rates are rays of
+// each kind per second of render time, so they add up to the total rate.
+// Without -output the report is all that goes to stdout; progress and the
+// log messages of the cases go to stderr. Like assignment4, run it from
+// inside the project so the assets are found.
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "Tracer.hpp"
+#include "SceneParser.hpp"
+#include "TraceStats.hpp"
+
+using namespace GLOO;
+
+namespace {
+struct BenchmarkCase {
+  const char* scene;
+  size_t width;
+  size_t height;
+  size_t bounces;
+  bool shadows;
+};
+
+// Fixed so that reports from different revisions stay comparable.
+const BenchmarkCase kCases[] = {
+    {"scene01_plane.txt", 400, 400, 4, true},
+    {"scene02_cube.txt", 400, 400, 4, true},
+    {"scene03_sphere.txt", 400, 400, 4, true},
+    {"scene04_axes.txt", 400, 400, 4, true},
+    {"scene05_bunny_200.txt", 400, 400, 4, true},
+    {"scene06_bunny_1k.txt", 400, 400, 4, true},
+    {"scene07_arch.txt", 400, 400, 4, true},
+};
+
+struct CaseResult {
+  const BenchmarkCase* spec;
+  double build_seconds;
+  double render_seconds;
+  double render_seconds_min;
+  double wall_seconds;
+  RayCounts rays;
+  double peak_rss_mb;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double Median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+// Peak resident set size of the process so far, or 0 where unknown.
+double GetPeakRssMB() {
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0.0;
+  }
+#ifdef __APPLE__
+  return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+  return usage.ru_maxrss / 1024.0;
+#endif
+#else
+  return 0.0;
+#endif
+}
+
+// Sends std::cout to std::cerr while in scope, so that the messages the
+// parser and tracer log cannot end up inside the JSON report.
+class StdoutToStderr {
+ public:
+  StdoutToStderr() : saved_(std::cout.rdbuf(std::cerr.rdbuf())) {
+  }
+  ~StdoutToStderr() {
+    std::cout.rdbuf(saved_);
+  }
+
+ private:
+  std::streambuf* saved_;
+};
+
+double GetMraysPerSecond(uint64_t rays, double seconds) {
+  return seconds > 0.0 ? rays / seconds * 1e-6 : 0.0;
+}
+
+CaseResult RunCase(const BenchmarkCase& spec,
+                   size_t warmup,
+                   size_t repetitions,
+                   size_t num_threads,
+                   bool packets,
+                   bool wavefront) {
+  StdoutToStderr redirect;
+  CaseResult result;
+  result.spec = &spec;
+  Clock::time_point case_start = Clock::now();
+  std::vector<double> build_seconds;
+  std::vector<double> render_seconds;
+  for (size_t run = 0; run < warmup + repetitions; run++) {
+    Clock::time_point start = Clock::now();
+    SceneParser scene_parser(AccelType::BVH, "");
+    auto scene = scene_parser.ParseScene("assignment4/" +
+                                         std::string(spec.scene));
+    if (scene == nullptr) {
+      throw std::runtime_error(std::string("Cannot load ") + spec.scene +
+                               "!");
+    }
+    double build = SecondsSince(start);
+
+    Tracer tracer(scene_parser.GetCameraSpec(),
+                  glm::ivec2(spec.width, spec.height), spec.bounces,
+                  scene_parser.GetBackgroundColor(),
+                  scene_parser.GetCubeMapPtr(), spec.shadows, num_threads,
+                  packets, wavefront, SamplingSpec());
+    TakeRayCounts();
+    start = Clock::now();
+    tracer.Render(*scene, "");
+    double render = SecondsSince(start);
+    RayCounts rays = TakeRayCounts();
+    if (run >= warmup) {
+      build_seconds.push_back(build);
+      render_seconds.push_back(render);
+      result.rays = rays;
+    }
+  }
+  result.build_seconds = Median(build_seconds);
+  result.render_seconds = Median(render_seconds);
+  result.render_seconds_min =
+      *std::min_element(render_seconds.begin(), render_seconds.end());
+  result.wall_seconds = SecondsSince(case_start);
+  result.peak_rss_mb = GetPeakRssMB();
+  return result;
+}
+
+void WriteReport(std::ostream& os,
+                 const std::vector<CaseResult>& results,
+                 size_t warmup,
+                 size_t repetitions,
+                 size_t num_threads,
+                 const char* engine,
+                 double wall_seconds) {
+  os << "{\n";
+  os << "  \"threads\": " << num_threads << ",\n";
+  os << "  \"engine\": \"" << engine << "\",\n";
+  os << "  \"warmup\": " << warmup << ",\n";
+  os << "  \"repetitions\": " << repetitions << ",\n";
+  os << "  \"cases\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const CaseResult& r = results[i];
+    double seconds = r.render_seconds;
+    os << "    {\n";
+    os << "      \"scene\": \"" << r.spec->scene << "\",\n";
+    os << "      \"width\": " << r.spec->width << ",\n";
+    os << "      \"height\": " << r.spec->height << ",\n";
+    os << "      \"bounces\": " << r.spec->bounces << ",\n";
+    os << "      \"shadows\": " << (r.spec->shadows ? "true" : "false")
+       << ",\n";
+    os << "      \"build_seconds\": " << r.build_seconds << ",\n";
+    os << "      \"render_seconds\": " << seconds << ",\n";
+    os << "      \"render_seconds_min\": " << r.render_seconds_min << ",\n";
+    os << "      \"wall_seconds\": " << r.wall_seconds << ",\n";
+    os << "      \"primary_rays\": " << r.rays.primary << ",\n";
+    os << "      \"secondary_rays\": " << r.rays.reflection << ",\n";
+    os << "      \"shadow_rays\": " << r.rays.shadow << ",\n";
+    os << "      \"primary_mrays_per_second\": "
+       << GetMraysPerSecond(r.rays.primary, seconds) << ",\n";
+    os << "      \"secondary_mrays_per_second\": "
+       << GetMraysPerSecond(r.rays.reflection, seconds) << ",\n";
+    os << "      \"shadow_mrays_per_second\": "
+       << GetMraysPerSecond(r.rays.shadow, seconds) << ",\n";
+    os << "      \"total_mrays_per_second\": "
+       << GetMraysPerSecond(r.rays.GetTotal(), seconds) << ",\n";
+    os << "      \"peak_rss_mb\": " << r.peak_rss_mb << "\n";
+    os << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  os << "  ],\n";
+  os << "  \"wall_seconds\": " << wall_seconds << ",\n";
+  os << "  \"peak_rss_mb\": " << GetPeakRssMB() << "\n";
+  os << "}\n";
+}
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  size_t repetitions = 3;
+  size_t warmup = 1;
+  size_t num_threads = 0;
+  bool packets = true;
+  bool wavefront = false;
+  std::string output_file;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-repetitions") && i + 1 < argc) {
+      repetitions = std::max(1, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "-warmup") && i + 1 < argc) {
+      warmup = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+      num_threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-no-packets")) {
+      packets = false;
+    } else if (!strcmp(argv[i], "-wavefront")) {
+      wavefront = true;
+    } else if (!strcmp(argv[i], "-output") && i + 1 < argc) {
+      output_file = argv[++i];
+    } else {
+      std::cerr << "Unknown command line argument " << i << ": '" << argv[i]
+                << "'" << std::endl;
+      return 1;
+    }
+  }
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const char* engine =
+      wavefront ? "wavefront" : (packets ? "packets" : "single rays");
+
+  Clock::time_point start = Clock::now();
+  std::vector<CaseResult> results;
+  for (const BenchmarkCase& spec : kCases) {
+    results.push_back(
+        RunCase(spec, warmup, repetitions, num_threads, packets, wavefront));
+    const CaseResult& r = results.back();
+    std::cerr << spec.scene << ": " << r.render_seconds << " s, "
+              << GetMraysPerSecond(r.rays.GetTotal(), r.render_seconds)
+              << " Mrays/s" << std::endl;
+  }
+  double wall_seconds = SecondsSince(start);
+
+  if (output_file.empty()) {
+    WriteReport(std::cout, results, warmup, repetitions, num_threads, engine,
+                wall_seconds);
+  } else {
+    std::ofstream out(output_file);
+    WriteReport(out, results, warmup, repetitions, num_threads, engine,
+                wall_seconds);
+    if (!out) {
+      throw std::runtime_error("Cannot write " + output_file + "!");
+    }
+  }
+  return 0;
+}
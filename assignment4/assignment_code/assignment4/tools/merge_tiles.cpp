@@ -0,0 +1,86 @@
+// Stitches the tile files of -region renders into the final image:
+//
+//   merge_tiles -output image.png tile0 tile1 ...
+//
+// The tiles must cover every pixel of the image exactly once. The output
+// is Radiance HDR if its name ends in .hdr and PNG otherwise.
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gloo/Image.hpp"
+
+#include "AccumulationBuffer.hpp"
+#include "TileFile.hpp"
+
+using namespace GLOO;
+
+namespace {
+bool EndsWith(const std::string& s, const std::string& suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  std::string output_file;
+  std::vector<std::string> tile_files;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-output") && i + 1 < argc) {
+      output_file = argv[++i];
+    } else {
+      tile_files.push_back(argv[i]);
+    }
+  }
+  if (output_file.empty() || tile_files.empty()) {
+    std::cerr << "Usage: " << argv[0] << " -output image.png tile..."
+              << std::endl;
+    return 1;
+  }
+
+  // Check that the tiles belong together before reading their samples.
+  TileInfo first = LoadTileInfo(tile_files[0]);
+  size_t width = first.image_size.x;
+  size_t height = first.image_size.y;
+  std::vector<uint8_t> covered(width * height, 0);
+  for (const std::string& file : tile_files) {
+    TileInfo info = LoadTileInfo(file);
+    if (info.image_size != first.image_size || info.filter != first.filter) {
+      throw std::runtime_error(file + " belongs to another image!");
+    }
+    for (size_t y = info.region.y0; y < info.region.y1; y++) {
+      for (size_t x = info.region.x0; x < info.region.x1; x++) {
+        if (covered[y * width + x]++) {
+          throw std::runtime_error(file + " overlaps an earlier tile!");
+        }
+      }
+    }
+  }
+  for (uint8_t c : covered) {
+    if (!c) {
+      throw std::runtime_error("The tiles do not cover the whole image!");
+    }
+  }
+
+  AccumulationBuffer buffer(first.image_size);
+  for (const std::string& file : tile_files) {
+    MergeTile(file, buffer);
+  }
+  Image image(width, height);
+  buffer.Resolve(image, first.filter);
+  std::string temp_file = output_file + ".tmp";
+  if (EndsWith(output_file, ".hdr")) {
+    image.SaveHDR(temp_file);
+  } else {
+    image.SavePNG(temp_file);
+  }
+  if (std::rename(temp_file.c_str(), output_file.c_str()) != 0) {
+    throw std::runtime_error("Cannot write " + output_file + "!");
+  }
+  std::cout << "Merged " << tile_files.size() << " tiles into "
+            << output_file << std::endl;
+  return 0;
+}
@@ -23,29 +23,35 @@ static uint8_t ClampColor(float c) {
 
 namespace GLOO {
 std::vector<uint8_t> Image::ToByteData() const {
-  std::vector<uint8_t> buffer;
+  // Sized up front: growing by push_back peaks at twice the final size
+  // for large images.
+  std::vector<uint8_t> buffer(width_ * height_ * 3);
 
-  for (int y = (int)height_ - 1; y >= 0; y--)
+  uint8_t* out = buffer.data();
+  for (int y = (int)height_ - 1; y >= 0; y--) {
+    const glm::vec3* row = &data_[size_t(y) * width_];
     for (size_t x = 0; x < width_; x++) {
-      const glm::vec3& color = GetPixel(x, static_cast<size_t>(y));
-      buffer.push_back(ClampColor(color[0]));
-      buffer.push_back(ClampColor(color[1]));
-      buffer.push_back(ClampColor(color[2]));
+      *out++ = ClampColor(row[x][0]);
+      *out++ = ClampColor(row[x][1]);
+      *out++ = ClampColor(row[x][2]);
     }
+  }
 
   return buffer;
 }
 
 std::vector<float> Image::ToFloatData() const {
-  std::vector<float> buffer;
+  std::vector<float> buffer(width_ * height_ * 3);
 
-  for (int y = (int)height_ - 1; y >= 0; y--)
+  float* out = buffer.data();
+  for (int y = (int)height_ - 1; y >= 0; y--) {
+    const glm::vec3* row = &data_[size_t(y) * width_];
     for (size_t x = 0; x < width_; x++) {
-      const glm::vec3& color = GetPixel(x, static_cast<size_t>(y));
-      buffer.push_back(color[0]);
-      buffer.push_back(color[1]);
-      buffer.push_back(color[2]);
+      *out++ = row[x][0];
+      *out++ = row[x][1];
+      *out++ = row[x][2];
     }
+  }
 
   return buffer;
 }
@@ -56,6 +62,12 @@ void Image::SavePNG(const std::string& filename) const {
                  (int)width_ * 3);
 }
 
+void Image::SaveHDR(const std::string& filename) const {
+  auto buffer = ToFloatData();
+  stbi_write_hdr(filename.c_str(), (int)width_, (int)height_, 3,
+                 buffer.data());
+}
+
 std::unique_ptr<Image> Image::LoadPNG(const std::string& filename,
                                       bool y_reversed) {
   int w, h, n;
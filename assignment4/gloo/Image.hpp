@@ -46,6 +46,8 @@ class Image {
   static std::unique_ptr<Image> LoadPNG(const std::string& filename,
                                         bool y_reversed);
   void SavePNG(const std::string& filename) const;
+  // Radiance HDR, keeping the unclamped floating-point colors.
+  void SaveHDR(const std::string& filename) const;
   std::vector<uint8_t> ToByteData() const;
   std::vector<float> ToFloatData() const;
 